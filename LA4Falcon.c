@@ -180,7 +180,7 @@ static void print_hits(const int hit_count, DAZZ_DBX *dbx2, char *bbuffer, char
 }
 
 static char *Usage[] =
-    { "[-smfocargyUFMPI] [-i<int(4)>] [-w<int(100)>] [-b<int(10)>] ",
+    { "[-smfocargyUFMPI] [-i<int(4)>] [-w<int(100)>] [-b<int(10)>] [-T<int(1)>] ",
       "    <src1:db|dam> [ <src2:db|dam> ] <align:las> [ <reads:FILE> | <reads:range> ... ]"
     };
 
@@ -211,6 +211,12 @@ int     FALCON, OVERLAP, M4OVL, IGNORE_INDELS;
 int     SEED_MIN, MAX_HIT_COUNT, SKIP;
 int     PRELOAD;
 int     WRITE_MAPPING_COORDS;
+int     NTHREADS;
+
+int     ar_wide, br_wide;
+int     ai_wide, bi_wide;
+int     mn_wide, mx_wide;
+int     tp_wide;
 
 void Compute_Detailed_Alignment(
     int small)
@@ -265,6 +271,232 @@ void Compute_Detailed_Alignment(
                   }
 }
 
+/* With -a or -r (and neither -f nor -m) the records to be displayed are collected in a batch
+ * whose alignments are computed in parallel with Compute_Trace_Batch and then displayed in
+ * order.  Each entry has its own copy of the record, trace points, and read buffers.
+ */
+
+typedef struct
+  { Overlap  ovl;          //  The record (ovl.path.trace = tpts)
+    int64    tps;          //  # of trace points of the record
+    int      tmax;         //  tpts has room for tmax trace point values
+    uint16  *tpts;
+    int      emax;         //  The entry's exact trace vector has room for emax integers
+    char    *abuffer;      //  Read buffers
+    char    *bbuffer;
+    char    *aseq, *bseq;  //  Loaded segments [amin,amax] and [bmin,bmax] of the reads
+    int      amin, amax;
+    int      bmin, bmax;
+  } Shown;
+
+typedef struct
+  { int         nmax;      //  Batch holds up to nmax records
+    int         n;         //  Current # of records in the batch
+    Shown      *rec;       //  rec[i], aln[i], and trace[i] are the record, alignment,
+    Alignment  *aln;       //    and exact trace vector of the i'th entry
+    int       **trace;
+    Work_Data **work;      //  A work packet for each thread
+  } Batch;
+
+#define BATCH_PER_THREAD 32
+
+static void New_Batch(Batch *b)
+{ int i;
+
+  if (NTHREADS > 1)
+    b->nmax = BATCH_PER_THREAD*NTHREADS;
+  else
+    b->nmax = 1;
+  b->n     = 0;
+  b->rec   = (Shown *) Malloc(sizeof(Shown)*b->nmax,"Allocating display batch");
+  b->aln   = (Alignment *) Malloc(sizeof(Alignment)*b->nmax,"Allocating display batch");
+  b->trace = (int **) Malloc(sizeof(int *)*b->nmax,"Allocating display batch");
+  b->work  = (Work_Data **) Malloc(sizeof(Work_Data *)*NTHREADS,"Allocating display batch");
+  if (b->rec == NULL || b->aln == NULL || b->trace == NULL || b->work == NULL)
+    exit (1);
+
+  b->work[0] = work;
+  for (i = 1; i < NTHREADS; i++)
+    { b->work[i] = New_Work_Data();
+      if (b->work[i] == NULL)
+        exit (1);
+    }
+
+  for (i = 0; i < b->nmax; i++)
+    { b->rec[i].tmax    = 0;
+      b->rec[i].tpts    = NULL;
+      b->rec[i].emax    = 0;
+      b->rec[i].abuffer = New_Read_Buffer(db1);
+      b->rec[i].bbuffer = New_Read_Buffer(db2);
+      if (b->rec[i].abuffer == NULL || b->rec[i].bbuffer == NULL)
+        exit (1);
+      b->trace[i]       = NULL;
+      b->aln[i].path    = &(b->rec[i].ovl.path);
+    }
+}
+
+static void Free_Batch(Batch *b)
+{ int i;
+
+  for (i = 0; i < b->nmax; i++)
+    { free(b->rec[i].bbuffer-1);
+      free(b->rec[i].abuffer-1);
+      free(b->rec[i].tpts);
+      free(b->trace[i]);
+    }
+  for (i = 1; i < NTHREADS; i++)
+    Free_Work_Data(b->work[i]);
+  free(b->work);
+  free(b->trace);
+  free(b->aln);
+  free(b->rec);
+}
+
+/* Add the current record ovl to the batch, loading the segments of the reads it aligns as
+ * Compute_Detailed_Alignment does.  The caller calls Show_Batch when the batch is full.
+ */
+
+static void Add_To_Batch(Batch *b, int64 tps)
+{ Shown     *r = b->rec + b->n;
+  Alignment *a = b->aln + b->n;
+  Overlap   *o = &(r->ovl);
+  int        len;
+
+  *o = *ovl;
+  if (o->path.tlen > r->tmax)
+    { r->tmax = (int) (1.2*o->path.tlen) + 100;
+      r->tpts = (uint16 *) Realloc(r->tpts,sizeof(uint16)*r->tmax,"Allocating trace vector");
+      if (r->tpts == NULL)
+        exit (1);
+    }
+  memcpy(r->tpts,ovl->path.trace,tbytes*o->path.tlen);
+  o->path.trace = (void *) r->tpts;
+  if (small)
+    Decompress_TraceTo16(o);
+
+  len = (o->path.aepos - o->path.abpos) + (o->path.bepos - o->path.bbpos);
+  if (len > r->emax)
+    { r->emax = (int) (1.2*len) + 100;
+      b->trace[b->n] = (int *) Realloc(b->trace[b->n],sizeof(int)*r->emax,
+                                       "Allocating trace vector");
+      if (b->trace[b->n] == NULL)
+        exit (1);
+    }
+
+  r->tps   = tps;
+  a->alen  = aln->alen;
+  a->blen  = aln->blen;
+  a->flags = aln->flags;
+
+  r->amin = o->path.abpos - BORDER;
+  if (r->amin < 0) r->amin = 0;
+  r->amax = o->path.aepos + BORDER;
+  if (r->amax > a->alen) r->amax = a->alen;
+  if (COMP(a->flags))
+    { r->bmin = (a->blen-o->path.bepos) - BORDER;
+      if (r->bmin < 0) r->bmin = 0;
+      r->bmax = (a->blen-o->path.bbpos) + BORDER;
+      if (r->bmax > a->blen) r->bmax = a->blen;
+    }
+  else
+    { r->bmin = o->path.bbpos - BORDER;
+      if (r->bmin < 0) r->bmin = 0;
+      r->bmax = o->path.bepos + BORDER;
+      if (r->bmax > a->blen) r->bmax = a->blen;
+    }
+
+  r->aseq = Load_Subread(db1,o->aread,r->amin,r->amax,r->abuffer,0);
+  r->bseq = Load_Subread(db2,o->bread,r->bmin,r->bmax,r->bbuffer,0);
+
+  a->aseq = r->aseq - r->amin;
+  if (COMP(a->flags))
+    { Complement_Seq(r->bseq,r->bmax-r->bmin);
+      a->bseq = r->bseq - (a->blen - r->bmax);
+    }
+  else
+    a->bseq = r->bseq - r->bmin;
+
+  b->n += 1;
+}
+
+/* Compute the alignments of the records in the batch and display them in order */
+
+static void Show_Batch(Batch *b)
+{ Shown     *r;
+  Overlap   *o;
+  Alignment *a;
+  int        i;
+
+  if (b->n == 0)
+    return;
+
+  if (Compute_Trace_Batch(b->n,b->aln,b->trace,b->work,NTHREADS,tspace,GREEDIEST))
+    exit (1);
+
+  for (i = 0; i < b->n; i++)
+    { r = b->rec + i;
+      o = &(r->ovl);
+      a = b->aln + i;
+
+      printf("\n");
+      if (FLIP)
+        { Flip_Alignment(a,0);
+          Print_Number((int64) o->bread+1,ar_wide+1,stdout);
+          printf("  ");
+          Print_Number((int64) o->aread+1,br_wide+1,stdout);
+        }
+      else
+        { Print_Number((int64) o->aread+1,ar_wide+1,stdout);
+          printf("  ");
+          Print_Number((int64) o->bread+1,br_wide+1,stdout);
+        }
+      if (COMP(o->flags))
+        printf(" c");
+      else
+        printf(" n");
+      printf("   [");
+      Print_Number((int64) o->path.abpos,ai_wide,stdout);
+      printf("..");
+      Print_Number((int64) o->path.aepos,ai_wide,stdout);
+      printf("] x [");
+      Print_Number((int64) o->path.bbpos,bi_wide,stdout);
+      printf("..");
+      Print_Number((int64) o->path.bepos,bi_wide,stdout);
+      printf("]");
+
+      if (FLIP)
+        { Flip_Alignment(a,0);
+          if (COMP(a->flags))
+            { Complement_Seq(r->aseq,r->amax-r->amin);
+              Complement_Seq(r->bseq,r->bmax-r->bmin);
+              a->aseq = r->aseq - (a->alen - r->amax);
+              a->bseq = r->bseq - r->bmin;
+            }
+          Flip_Alignment(a,1);
+        }
+
+      if (CARTOON)
+        { printf("  (");
+          Print_Number(r->tps,tp_wide,stdout);
+          printf(" trace pts)\n\n");
+          Alignment_Cartoon(stdout,a,INDENT,mx_wide);
+        }
+      else
+        { printf(" :   = ");
+          Print_Number((int64) o->path.diffs,mn_wide,stdout);
+          printf(" diffs  (");
+          Print_Number(r->tps,tp_wide,stdout);
+          printf(" trace pts)\n");
+        }
+      if (REFERENCE)
+        Print_Reference(stdout,a,work,INDENT,WIDTH,BORDER,UPPERCASE,mx_wide);
+      if (ALIGN)
+        Print_Alignment(stdout,a,work,INDENT,WIDTH,BORDER,UPPERCASE,mx_wide);
+    }
+
+  b->n = 0;
+}
+
 int main(int argc, char *argv[])
 {
   DAZZ_DBX   _dbx1, *dbx1 = &_dbx1;
@@ -305,6 +537,7 @@ int main(int argc, char *argv[])
     CARTOON   = 0;
     FLIP      = 0;
     MAX_HIT_COUNT = 400;
+    NTHREADS  = 1;
 
     WRITE_MAPPING_COORDS = 0;
 
@@ -327,6 +560,9 @@ int main(int argc, char *argv[])
           case 'H':
             ARG_POSITIVE(SEED_MIN,"seed threshold (in bp)")
             break;
+          case 'T':
+            ARG_POSITIVE(NTHREADS,"Number of threads")
+            break;
           case 'n':
             ARG_POSITIVE(MAX_HIT_COUNT, "max numer of supporting read ouput (used for FALCON consensus. default 400, max: 2000)")
             if (MAX_HIT_COUNT > 2000) MAX_HIT_COUNT = 2000;
@@ -584,12 +820,10 @@ int main(int argc, char *argv[])
     char       buffer[131072];
     int        skip_rest = 0;
 
-    int        ar_wide, br_wide;
-    int        ai_wide, bi_wide;
-    int        mn_wide, mx_wide;
-    int        tp_wide;
     int        blast, match, seen, lhalf, rhalf;
     int        hit_count;
+    int        batched;
+    Batch      batch;
 
     aln->path = &(ovl->path);
     if (ALIGN || REFERENCE || FALCON || (M4OVL && IGNORE_INDELS))
@@ -607,6 +841,11 @@ int main(int argc, char *argv[])
         work = NULL;
       }
 
+    batched = (ALIGN || REFERENCE) && !(FALCON || M4OVL);
+    batch.n = 0;
+    if (batched)
+      New_Batch(&batch);
+
     tmax  = 1000;
     trace = (uint16 *) Malloc(sizeof(uint16)*tmax,"Allocating trace vector");
     if (trace == NULL)
@@ -730,7 +969,8 @@ int main(int argc, char *argv[])
         if (MAP)
           { while (ovl->bread != blast)
               { if (!match && seen && !(lhalf && rhalf))
-                  { printf("Missing ");
+                  { Show_Batch(&batch);
+                    printf("Missing ");
                     Print_Number((int64) blast+1,br_wide+1,stdout);
                     printf(" %d ->%lld\n",db2->reads[blast].rlen,db2->reads[blast].coff);
                   }
@@ -752,6 +992,13 @@ int main(int argc, char *argv[])
         // printf(" %7d %7d\n",ovl->path.abpos,ovl->path.aepos);
         // continue;
 
+        if (batched)
+          { Add_To_Batch(&batch,tps);
+            if (batch.n >= batch.nmax)
+              Show_Batch(&batch);
+            continue;
+          }
+
         if (!(FALCON || M4OVL) ) {
             if (ALIGN || CARTOON || REFERENCE)
               printf("\n");
@@ -913,6 +1160,11 @@ int main(int argc, char *argv[])
           }
       }
 
+    if (batched)
+      { Show_Batch(&batch);
+        Free_Batch(&batch);
+      }
+
     // debugging
     time_t mytime = time(NULL);
     fprintf(stderr, "\ncompleted loop record j = %d out of %lld at %s %s\n", j, novl, argv[3], ctime(&mytime));
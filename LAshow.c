@@ -22,7 +22,7 @@
 #include "align.h"
 
 static char *Usage[] =
-    { "[-caroUF] [-i<int(4)>] [-w<int(100)>] [-b<int(10)>] ",
+    { "[-caroUF] [-i<int(4)>] [-w<int(100)>] [-b<int(10)>] [-T<int(1)>]",
       "    <src1:db|dam> [ <src2:db|dam> ] <align:las> [ <reads:FILE> | <reads:range> ... ]"
     };
 
@@ -32,6 +32,299 @@ static int ORDER(const void *l, const void *r)
   return (x-y);
 }
 
+static int ALIGN, CARTOON, REFERENCE;   //  Display options
+static int FLIP, INDENT, WIDTH, BORDER, UPPERCASE;
+static int NTHREADS;                     //  # of threads computing alignments (-T)
+
+static int ar_wide, br_wide;             //  Field widths of the display
+static int ai_wide, bi_wide;
+static int mn_wide, mx_wide;
+static int tp_wide;
+
+//  Print the header line of overlap ovl with alignment record aln, flipping aln if -F.
+//    The number of trace points and differences are passed as the trace computation
+//    overwrites the record's.
+
+static void Show_Header(Overlap *ovl, Alignment *aln, int64 tps, int diffs)
+{ if (ALIGN || CARTOON || REFERENCE)
+    printf("\n");
+
+  if (BEST_CHAIN(ovl->flags))
+    printf("> ");
+  else if (CHAIN_START(ovl->flags))
+    printf("+ ");
+  else if (CHAIN_NEXT(ovl->flags))
+    printf(" -");
+
+  if (FLIP)
+    { Flip_Alignment(aln,0);
+      Print_Number((int64) ovl->bread+1,ar_wide+1,stdout);
+      printf("  ");
+      Print_Number((int64) ovl->aread+1,br_wide+1,stdout);
+    }
+  else
+    { Print_Number((int64) ovl->aread+1,ar_wide+1,stdout);
+      printf("  ");
+      Print_Number((int64) ovl->bread+1,br_wide+1,stdout);
+    }
+  if (COMP(ovl->flags))
+    printf(" c");
+  else
+    printf(" n");
+  if (ovl->path.abpos == 0)
+    printf("   <");
+  else
+    printf("   [");
+  Print_Number((int64) ovl->path.abpos,ai_wide,stdout);
+  printf("..");
+  Print_Number((int64) ovl->path.aepos,ai_wide,stdout);
+  if (ovl->path.aepos == aln->alen)
+    printf("> x ");
+  else
+    printf("] x ");
+  if (ovl->path.bbpos == 0)
+    printf("<");
+  else
+    printf("[");
+  if (COMP(ovl->flags))
+    { Print_Number((int64) (aln->blen - ovl->path.bbpos),bi_wide,stdout);
+      printf("..");
+      Print_Number((int64) (aln->blen - ovl->path.bepos),bi_wide,stdout);
+    }
+  else
+    { Print_Number((int64) ovl->path.bbpos,bi_wide,stdout);
+      printf("..");
+      Print_Number((int64) ovl->path.bepos,bi_wide,stdout);
+    }
+  if (ovl->path.bepos == aln->blen)
+    printf(">");
+  else
+    printf("]");
+
+  if (!CARTOON)
+    printf("  ~  %5.2f%% ",(200.*diffs) /
+           ((ovl->path.aepos - ovl->path.abpos) + (ovl->path.bepos - ovl->path.bbpos)) );
+  printf("  (");
+  Print_Number(aln->alen,ai_wide,stdout);
+  printf(" x ");
+  Print_Number(aln->blen,bi_wide,stdout);
+  printf(" bps,");
+  if (CARTOON)
+    { Print_Number(tps,tp_wide,stdout);
+      printf(" trace pts)\n\n");
+    }
+  else
+    { Print_Number((int64) diffs,mn_wide,stdout);
+      printf(" diffs, ");
+      Print_Number(tps,tp_wide,stdout);
+      printf(" trace pts)\n");
+    }
+}
+
+//  With -a or -r the records to be displayed are collected in a batch whose alignments are
+//    computed in parallel with Compute_Trace_Batch and then displayed in order.  Each entry
+//    has its own copy of the record, trace points, and read buffers.
+
+typedef struct
+  { Overlap  ovl;          //  The record (ovl.path.trace = tpts)
+    int64    tps;          //  # of trace points and diffs of the record
+    int      diffs;
+    int      tmax;         //  tpts has room for tmax trace point values
+    uint16  *tpts;
+    int      emax;         //  The entry's exact trace vector has room for emax integers
+    char    *abuffer;      //  Read buffers
+    char    *bbuffer;
+    char    *aseq, *bseq;  //  Loaded segments [amin,amax] and [bmin,bmax] of the reads
+    int      amin, amax;
+    int      bmin, bmax;
+  } Shown;
+
+typedef struct
+  { int         nmax;      //  Batch holds up to nmax records
+    int         n;         //  Current # of records in the batch
+    Shown      *rec;       //  rec[i], aln[i], and trace[i] are the record, alignment,
+    Alignment  *aln;       //    and exact trace vector of the i'th entry
+    int       **trace;
+    Work_Data **work;      //  A work packet for each thread
+  } Batch;
+
+#define BATCH_PER_THREAD 32
+
+static void New_Batch(Batch *b, DAZZ_DB *db1, DAZZ_DB *db2)
+{ int i;
+
+  if (NTHREADS > 1)
+    b->nmax = BATCH_PER_THREAD*NTHREADS;
+  else
+    b->nmax = 1;
+  b->n     = 0;
+  b->rec   = (Shown *) Malloc(sizeof(Shown)*b->nmax,"Allocating display batch");
+  b->aln   = (Alignment *) Malloc(sizeof(Alignment)*b->nmax,"Allocating display batch");
+  b->trace = (int **) Malloc(sizeof(int *)*b->nmax,"Allocating display batch");
+  b->work  = (Work_Data **) Malloc(sizeof(Work_Data *)*NTHREADS,"Allocating display batch");
+  if (b->rec == NULL || b->aln == NULL || b->trace == NULL || b->work == NULL)
+    exit (1);
+
+  for (i = 0; i < NTHREADS; i++)
+    { b->work[i] = New_Work_Data();
+      if (b->work[i] == NULL)
+        exit (1);
+    }
+
+  for (i = 0; i < b->nmax; i++)
+    { b->rec[i].tmax    = 0;
+      b->rec[i].tpts    = NULL;
+      b->rec[i].emax    = 0;
+      b->rec[i].abuffer = New_Read_Buffer(db1);
+      b->rec[i].bbuffer = New_Read_Buffer(db2);
+      if (b->rec[i].abuffer == NULL || b->rec[i].bbuffer == NULL)
+        exit (1);
+      b->trace[i]       = NULL;
+      b->aln[i].path    = &(b->rec[i].ovl.path);
+    }
+}
+
+static void Free_Batch(Batch *b)
+{ int i;
+
+  for (i = 0; i < b->nmax; i++)
+    { free(b->rec[i].bbuffer-1);
+      free(b->rec[i].abuffer-1);
+      free(b->rec[i].tpts);
+      free(b->trace[i]);
+    }
+  for (i = 0; i < NTHREADS; i++)
+    Free_Work_Data(b->work[i]);
+  free(b->work);
+  free(b->trace);
+  free(b->aln);
+  free(b->rec);
+}
+
+//  Add ovl (whose alignment record is aln) to the batch, loading the segments of the reads
+//    it aligns.  The caller calls Show_Batch when the batch is full.
+
+static void Add_To_Batch(Batch *b, Overlap *ovl, Alignment *aln, int64 tps,
+                         DAZZ_DB *db1, DAZZ_DB *db2, int self, int small)
+{ Shown     *r = b->rec + b->n;
+  Alignment *a = b->aln + b->n;
+  Overlap   *o = &(r->ovl);
+  int        len;
+
+  *o = *ovl;
+  if (o->path.tlen > r->tmax)
+    { r->tmax = (int) (1.2*o->path.tlen) + 100;
+      r->tpts = (uint16 *) Realloc(r->tpts,sizeof(uint16)*r->tmax,"Allocating trace vector");
+      if (r->tpts == NULL)
+        exit (1);
+    }
+  if (small)
+    memcpy(r->tpts,ovl->path.trace,sizeof(uint8)*o->path.tlen);
+  else
+    memcpy(r->tpts,ovl->path.trace,sizeof(uint16)*o->path.tlen);
+  o->path.trace = (void *) r->tpts;
+  if (small)
+    Decompress_TraceTo16(o);
+
+  len = (o->path.aepos - o->path.abpos) + (o->path.bepos - o->path.bbpos);
+  if (len > r->emax)
+    { r->emax = (int) (1.2*len) + 100;
+      b->trace[b->n] = (int *) Realloc(b->trace[b->n],sizeof(int)*r->emax,
+                                       "Allocating trace vector");
+      if (b->trace[b->n] == NULL)
+        exit (1);
+    }
+
+  r->tps   = tps;
+  r->diffs = o->path.diffs;
+
+  a->alen  = aln->alen;
+  a->blen  = aln->blen;
+  a->flags = aln->flags;
+
+  r->amin = o->path.abpos - BORDER;
+  if (r->amin < 0) r->amin = 0;
+  r->amax = o->path.aepos + BORDER;
+  if (r->amax > a->alen) r->amax = a->alen;
+  if (COMP(a->flags))
+    { r->bmin = (a->blen-o->path.bepos) - BORDER;
+      if (r->bmin < 0) r->bmin = 0;
+      r->bmax = (a->blen-o->path.bbpos) + BORDER;
+      if (r->bmax > a->blen) r->bmax = a->blen;
+    }
+  else
+    { r->bmin = o->path.bbpos - BORDER;
+      if (r->bmin < 0) r->bmin = 0;
+      r->bmax = o->path.bepos + BORDER;
+      if (r->bmax > a->blen) r->bmax = a->blen;
+      if (self)
+        { if (r->bmin < r->amin)
+            r->amin = r->bmin;
+          if (r->bmax > r->amax)
+            r->amax = r->bmax;
+        }
+    }
+
+  r->aseq = Load_Subread(db1,o->aread,r->amin,r->amax,r->abuffer,0);
+  if (!self)
+    r->bseq = Load_Subread(db2,o->bread,r->bmin,r->bmax,r->bbuffer,0);
+  else
+    r->bseq = r->aseq;
+
+  a->aseq = r->aseq - r->amin;
+  if (COMP(a->flags))
+    { Complement_Seq(r->bseq,r->bmax-r->bmin);
+      a->bseq = r->bseq - (a->blen - r->bmax);
+    }
+  else if (self)
+    a->bseq = a->aseq;
+  else
+    a->bseq = r->bseq - r->bmin;
+
+  b->n += 1;
+}
+
+//  Compute the alignments of the records in the batch and display them in order
+
+static void Show_Batch(Batch *b, int tspace)
+{ Shown     *r;
+  Alignment *a;
+  int        i;
+
+  if (b->n == 0)
+    return;
+
+  if (Compute_Trace_Batch(b->n,b->aln,b->trace,b->work,NTHREADS,tspace,GREEDIEST))
+    exit (1);
+
+  for (i = 0; i < b->n; i++)
+    { r = b->rec + i;
+      a = b->aln + i;
+
+      Show_Header(&(r->ovl),a,r->tps,r->diffs);
+
+      if (FLIP)
+        { Flip_Alignment(a,0);
+          if (COMP(a->flags))
+            { Complement_Seq(r->aseq,r->amax-r->amin);
+              Complement_Seq(r->bseq,r->bmax-r->bmin);
+              a->aseq = r->aseq - (a->alen - r->amax);
+              a->bseq = r->bseq - r->bmin;
+            }
+          Flip_Alignment(a,1);
+        }
+
+      if (CARTOON)
+        Alignment_Cartoon(stdout,a,INDENT,mx_wide);
+      if (REFERENCE)
+        Print_Reference(stdout,a,b->work[0],INDENT,WIDTH,BORDER,UPPERCASE,mx_wide);
+      if (ALIGN)
+        Print_Alignment(stdout,a,b->work[0],INDENT,WIDTH,BORDER,UPPERCASE,mx_wide);
+    }
+
+  b->n = 0;
+}
+
 int main(int argc, char *argv[])
 { DAZZ_DB   _db1, *db1 = &_db1; 
   DAZZ_DB   _db2, *db2 = &_db2; 
@@ -45,9 +338,7 @@ int main(int argc, char *argv[])
   int     reps, *pts;
   int     input_pts;
 
-  int     ALIGN, CARTOON, REFERENCE, OVERLAP;
-  int     FLIP, MAP;
-  int     INDENT, WIDTH, BORDER, UPPERCASE;
+  int     OVERLAP, MAP;
   int     ISTWO;
 
   //  Process options
@@ -61,6 +352,7 @@ int main(int argc, char *argv[])
     INDENT    = 4;
     WIDTH     = 100;
     BORDER    = 10;
+    NTHREADS  = 1;
 
     j = 1;
     for (i = 1; i < argc; i++)
@@ -78,6 +370,9 @@ int main(int argc, char *argv[])
           case 'b':
             ARG_NON_NEGATIVE(BORDER,"Alignment border")
             break;
+          case 'T':
+            ARG_POSITIVE(NTHREADS,"Number of threads")
+            break;
         }
       else
         argv[j++] = argv[i];
@@ -105,6 +400,7 @@ int main(int argc, char *argv[])
         fprintf(stderr,"      -i: Indent alignments and cartoons by -i.\n");
         fprintf(stderr,"      -w: Width of each row of alignment in symbols (-a) or bps (-r).\n");
         fprintf(stderr,"      -b: # of border bp.s to show on each side of LA.\n");
+        fprintf(stderr,"      -T: Use -T threads to compute the alignments of -a and -r.\n");
         exit (1);
       }
   }
@@ -322,29 +618,17 @@ int main(int argc, char *argv[])
   
   { int        j;
     uint16    *trace;
-    Work_Data *work;
     int        tmax;
     int        in, npt, idx, ar;
     int64      tps;
 
-    char      *abuffer, *bbuffer;
-    int        ar_wide, br_wide;
-    int        ai_wide, bi_wide;
-    int        mn_wide, mx_wide;
-    int        tp_wide;
     int        blast, match, seen, lhalf, rhalf;
+    Batch      batch;
 
     aln->path = &(ovl->path);
+    batch.n   = 0;
     if (ALIGN || REFERENCE)
-      { work = New_Work_Data();
-        abuffer = New_Read_Buffer(db1);
-        bbuffer = New_Read_Buffer(db2);
-      }
-    else
-      { abuffer = NULL;
-        bbuffer = NULL;
-        work = NULL;
-      }
+      New_Batch(&batch,db1,db2);
 
     tmax  = 1000;
     trace = (uint16 *) Malloc(sizeof(uint16)*tmax,"Allocating trace vector");
@@ -462,7 +746,8 @@ int main(int argc, char *argv[])
         if (MAP)
           { while (ovl->bread != blast)
               { if (!match && seen && !(lhalf && rhalf))
-                  { printf("Missing ");
+                  { Show_Batch(&batch,tspace);
+                    printf("Missing ");
                     Print_Number((int64) blast+1,br_wide+1,stdout);
                     printf(" %d ->%lld\n",db2->reads[blast].rlen,db2->reads[blast].coff);
                   }
@@ -481,164 +766,26 @@ int main(int argc, char *argv[])
             match = 1;
           }
 
-        //  Display it
+        //  Display it, or with -a or -r add it to the batch whose alignments are next computed
             
-        if (ALIGN || CARTOON || REFERENCE)
-          printf("\n");
-
-        if (BEST_CHAIN(ovl->flags))
-          printf("> ");
-        else if (CHAIN_START(ovl->flags))
-          printf("+ ");
-        else if (CHAIN_NEXT(ovl->flags))
-          printf(" -");
-
-        if (FLIP)
-          { Flip_Alignment(aln,0);
-            Print_Number((int64) ovl->bread+1,ar_wide+1,stdout);
-            printf("  ");
-            Print_Number((int64) ovl->aread+1,br_wide+1,stdout);
-          }
-        else
-          { Print_Number((int64) ovl->aread+1,ar_wide+1,stdout);
-            printf("  ");
-            Print_Number((int64) ovl->bread+1,br_wide+1,stdout);
-          }
-        if (COMP(ovl->flags))
-          printf(" c");
-        else
-          printf(" n");
-        if (ovl->path.abpos == 0)
-          printf("   <");
-        else
-          printf("   [");
-        Print_Number((int64) ovl->path.abpos,ai_wide,stdout);
-        printf("..");
-        Print_Number((int64) ovl->path.aepos,ai_wide,stdout);
-        if (ovl->path.aepos == aln->alen)
-          printf("> x ");
-        else
-          printf("] x ");
-        if (ovl->path.bbpos == 0)
-          printf("<");
-        else
-          printf("[");
-        if (COMP(ovl->flags))
-          { Print_Number((int64) (aln->blen - ovl->path.bbpos),bi_wide,stdout);
-            printf("..");
-            Print_Number((int64) (aln->blen - ovl->path.bepos),bi_wide,stdout);
-          }
-        else
-          { Print_Number((int64) ovl->path.bbpos,bi_wide,stdout);
-            printf("..");
-            Print_Number((int64) ovl->path.bepos,bi_wide,stdout);
-          }
-        if (ovl->path.bepos == aln->blen)
-          printf(">");
-        else
-          printf("]");
-
-        if (!CARTOON)
-          printf("  ~  %5.2f%% ",(200.*ovl->path.diffs) /
-                 ((ovl->path.aepos - ovl->path.abpos) + (ovl->path.bepos - ovl->path.bbpos)) );
-        printf("  (");
-        Print_Number(aln->alen,ai_wide,stdout);
-        printf(" x ");
-        Print_Number(aln->blen,bi_wide,stdout);
-        printf(" bps,");
-        if (CARTOON)
-          { Print_Number(tps,tp_wide,stdout);
-            printf(" trace pts)\n\n");
+        if (ALIGN || REFERENCE)
+          { int self = sameDB && (ovl->aread == ovl->bread) && !COMP(ovl->flags);
+
+            Add_To_Batch(&batch,ovl,aln,tps,db1,db2,self,small);
+            if (batch.n >= batch.nmax)
+              Show_Batch(&batch,tspace);
           }
         else
-          { Print_Number((int64) ovl->path.diffs,mn_wide,stdout);
-            printf(" diffs, ");
-            Print_Number(tps,tp_wide,stdout);
-            printf(" trace pts)\n");
-          }
-
-        if (ALIGN || CARTOON || REFERENCE)
-          { if (ALIGN || REFERENCE)
-              { char *aseq, *bseq;
-                int   amin,  amax;
-                int   bmin,  bmax;
-                int   self;
-
-                if (FLIP)
-                  Flip_Alignment(aln,0);
-                if (small)
-                  Decompress_TraceTo16(ovl);
-
-                self = sameDB && (ovl->aread == ovl->bread) && !COMP(ovl->flags);
-
-                amin = ovl->path.abpos - BORDER;
-                if (amin < 0) amin = 0;
-                amax = ovl->path.aepos + BORDER;
-                if (amax > aln->alen) amax = aln->alen;
-                if (COMP(aln->flags))
-                  { bmin = (aln->blen-ovl->path.bepos) - BORDER;
-                    if (bmin < 0) bmin = 0;
-                    bmax = (aln->blen-ovl->path.bbpos) + BORDER;
-                    if (bmax > aln->blen) bmax = aln->blen;
-                  }
-                else
-                  { bmin = ovl->path.bbpos - BORDER;
-                    if (bmin < 0) bmin = 0;
-                    bmax = ovl->path.bepos + BORDER;
-                    if (bmax > aln->blen) bmax = aln->blen;
-                    if (self)
-                      { if (bmin < amin)
-                          amin = bmin;
-                        if (bmax > amax)
-                          amax = bmax;
-                      }
-                  }
-
-                aseq = Load_Subread(db1,ovl->aread,amin,amax,abuffer,0);
-                if (!self)
-                  bseq = Load_Subread(db2,ovl->bread,bmin,bmax,bbuffer,0);
-                else
-                  bseq = aseq;
-
-                aln->aseq = aseq - amin;
-                if (COMP(aln->flags))
-                  { Complement_Seq(bseq,bmax-bmin);
-                    aln->bseq = bseq - (aln->blen - bmax);
-                  }
-                else if (self)
-                  aln->bseq = aln->aseq;
-                else
-                  aln->bseq = bseq - bmin;
-
-                if (tspace == 0)
-                  Compute_Trace_IRR(aln,work,GREEDIEST);
-                else
-                  Compute_Trace_PTS(aln,work,tspace,GREEDIEST);
-
-                if (FLIP)
-                  { if (COMP(aln->flags))
-                      { Complement_Seq(aseq,amax-amin);
-                        Complement_Seq(bseq,bmax-bmin);
-                        aln->aseq = aseq - (aln->alen - amax);
-                        aln->bseq = bseq - bmin;
-                      }
-                    Flip_Alignment(aln,1);
-                  }
-              }
+          { Show_Header(ovl,aln,tps,ovl->path.diffs);
             if (CARTOON)
               Alignment_Cartoon(stdout,aln,INDENT,mx_wide);
-            if (REFERENCE)
-              Print_Reference(stdout,aln,work,INDENT,WIDTH,BORDER,UPPERCASE,mx_wide);
-            if (ALIGN)
-              Print_Alignment(stdout,aln,work,INDENT,WIDTH,BORDER,UPPERCASE,mx_wide);
           }
       }
 
     free(trace);
-    if (ALIGN)
-      { free(bbuffer-1);
-        free(abuffer-1);
-        Free_Work_Data(work);
+    if (ALIGN || REFERENCE)
+      { Show_Batch(&batch,tspace);
+        Free_Batch(&batch);
       }
   }
 
@@ -20,6 +20,7 @@
 #include <unistd.h>
 #include <math.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include "DB.h"
 #include "align.h"
@@ -42,6 +43,21 @@
 
 #undef  WAVE_STATS
 
+#define SIMD_SNAKE         //  Extend snakes 16 or 32 bases at a time with SSE2 or AVX2
+
+#ifndef SNAKE_CORR
+#define SNAKE_CORR  .85    //    but only for specs with ave_corr >= this (see snake_bench.c)
+#endif
+
+#if defined(SIMD_SNAKE) && !defined(NO_SIMD_SNAKE) && defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+
+static int Snake_AVX2 = 0;   //  Set by New_Align_Spec if the CPU supports AVX2
+
+#else
+#undef SIMD_SNAKE
+#endif
+
 
 /****************************************************************************************\
 *                                                                                        *
@@ -60,8 +76,16 @@ typedef struct            //  Hidden from the user, working space for each threa
     void   *trace;
     int     alnmax;
     void   *alnpts;
+    int     bitmax;
+    void   *bitvec;
+    void   *arena;        //  Single block holding the initial buffers of New_Work_Data_Sized
+    int64   arnlen;
+    int64   grows;        //  # of times a buffer has been (re)allocated to a larger size
   } _Work_Data;
 
+#define IN_ARENA(w,p)  ((w)->arena != NULL && (char *) (p) >= (char *) (w)->arena \
+                                            && (char *) (p) <  ((char *) (w)->arena) + (w)->arnlen)
+
 Work_Data *New_Work_Data()
 { _Work_Data *work;
   
@@ -78,15 +102,39 @@ Work_Data *New_Work_Data()
   work->alnpts = NULL;
   work->celmax = 0;
   work->cells  = NULL;
+  work->bitmax = 0;
+  work->bitvec = NULL;
+  work->arena  = NULL;
+  work->arnlen = 0;
+  work->grows  = 0;
   return ((Work_Data *) work);
 }
 
+int64 Work_Data_Enlargements(Work_Data *work)
+{ return (((_Work_Data *) work)->grows); }
+
+//  Enlarge buffer vec from omax to max bytes preserving its contents.  A buffer carved from
+//    the arena cannot be realloc'd and so is moved to a block of its own.
+
+static void *regrow(_Work_Data *work, void *vec, int64 omax, int64 max, char *mesg)
+{ void *nvec;
+
+  work->grows += 1;
+  if (IN_ARENA(work,vec))
+    { nvec = Malloc(max,mesg);
+      if (nvec != NULL)
+        memcpy(nvec,vec,omax);
+      return (nvec);
+    }
+  return (Realloc(vec,max,mesg));
+}
+
 static int enlarge_vector(_Work_Data *work, int newmax)
 { void *vec;
   int   max;
 
   max = ((int) (newmax*1.2)) + 10000;
-  vec = Realloc(work->vector,max,"Enlarging DP vector");
+  vec = regrow(work,work->vector,work->vecmax,max,"Enlarging DP vector");
   if (vec == NULL)
     EXIT(1);
   work->vecmax = max;
@@ -99,7 +147,7 @@ static int enlarge_points(_Work_Data *work, int newmax)
   int   max;
 
   max = ((int) (newmax*1.2)) + 10000;
-  vec = Realloc(work->points,max,"Enlarging point vector");
+  vec = regrow(work,work->points,work->pntmax,max,"Enlarging point vector");
   if (vec == NULL)
     EXIT(1);
   work->pntmax = max;
@@ -112,7 +160,7 @@ static int enlarge_alnpts(_Work_Data *work, int newmax)
   int   max;
 
   max = ((int) (newmax*1.2)) + 10000;
-  vec = Realloc(work->alnpts,max,"Enlarging point vector");
+  vec = regrow(work,work->alnpts,work->alnmax,max,"Enlarging point vector");
   if (vec == NULL)
     EXIT(1);
   work->alnmax = max;
@@ -125,7 +173,7 @@ static int enlarge_trace(_Work_Data *work, int newmax)
   int   max;
 
   max = ((int) (newmax*1.2)) + 10000;
-  vec = Realloc(work->trace,max,"Enlarging trace vector");
+  vec = regrow(work,work->trace,work->tramax,max,"Enlarging trace vector");
   if (vec == NULL)
     EXIT(1);
   work->tramax = max;
@@ -133,18 +181,35 @@ static int enlarge_trace(_Work_Data *work, int newmax)
   return (0);
 }
 
+static int enlarge_bitvec(_Work_Data *work, int newmax)
+{ void *vec;
+  int   max;
+
+  max = ((int) (newmax*1.2)) + 10000;
+  vec = regrow(work,work->bitvec,work->bitmax,max,"Enlarging bit-vector columns");
+  if (vec == NULL)
+    EXIT(1);
+  work->bitmax = max;
+  work->bitvec = vec;
+  return (0);
+}
+
 void Free_Work_Data(Work_Data *ework)
 { _Work_Data *work = (_Work_Data *) ework;
-  if (work->vector != NULL)
+  if (work->vector != NULL && ! IN_ARENA(work,work->vector))
     free(work->vector);
-  if (work->cells != NULL)
+  if (work->cells != NULL && ! IN_ARENA(work,work->cells))
     free(work->cells);
-  if (work->trace != NULL)
+  if (work->trace != NULL && ! IN_ARENA(work,work->trace))
     free(work->trace);
-  if (work->points != NULL)
+  if (work->points != NULL && ! IN_ARENA(work,work->points))
     free(work->points);
   if (work->alnpts != NULL)
     free(work->alnpts);
+  if (work->bitvec != NULL)
+    free(work->bitvec);
+  if (work->arena != NULL)
+    free(work->arena);
   free(work);
 }
 
@@ -184,6 +249,7 @@ typedef struct
     int    reach;
     float  freq[4];
     int    ave_path;
+    int    snake;        //  Extend snakes with the SIMD code (SIMD_SNAKE)
     int16 *score;
     int16 *table;
   } _Align_Spec;
@@ -258,6 +324,13 @@ Align_Spec *New_Align_Spec(double ave_corr, int trace_space, float *freq, int re
 
   set_table(0,0,0,0,&parms);
 
+#ifdef SIMD_SNAKE
+  Snake_AVX2  = __builtin_cpu_supports("avx2");
+  spec->snake = (ave_corr >= SNAKE_CORR);
+#else
+  spec->snake = 0;
+#endif
+
   spec->table = parms.table;
   spec->score = parms.score;
 
@@ -333,6 +406,143 @@ static void print_wave(int *V, int *M, int low, int hgh, int besta)
 
 #endif
 
+#ifdef SIMD_SNAKE
+
+/* Snake extension: the number of consecutive positions from a and b onward (forward_snake)
+     or backward (reverse_snake) where the bases are equal and not the terminator 4.  Most
+     snakes off the best path end within a base or two so the first SNAKE_PROBE are checked
+     one at a time, thereafter 16 bases are compared per step (SSE2), and 32 (AVX2) once a
+     snake is longer than 16 if the CPU has it.  A load never reaches past the terminators
+     of the two reads, aend and bend going forward and abeg and bbeg going backward, the
+     last few bases before them being done one at a time.
+   At higher error rates snakes are too short for the vector loads to pay, so the waves
+     only use this code for a spec whose ave_corr is >= SNAKE_CORR (spec->snake).
+*/
+
+#define SNAKE_PROBE  2   //  # of bases of a snake checked one at a time before going wide
+
+__attribute__((target("avx2")))
+static int forward_snake_avx2(char *a, char *b, int n, int lim)
+{ __m256i four = _mm256_set1_epi8(4);
+  __m256i va, vb;
+  uint32  stop;
+
+  while (n+32 <= lim)
+    { va   = _mm256_loadu_si256((__m256i *) (a+n));
+      vb   = _mm256_loadu_si256((__m256i *) (b+n));
+      stop = ~ (uint32) _mm256_movemask_epi8(_mm256_cmpeq_epi8(va,vb))
+           | (uint32) _mm256_movemask_epi8(_mm256_cmpeq_epi8(vb,four));
+      if (stop != 0)
+        return (n + __builtin_ctz(stop));
+      n += 32;
+    }
+  while (b[n] != 4 && a[n] == b[n])
+    n += 1;
+  return (n);
+}
+
+__attribute__((target("avx2")))
+static int reverse_snake_avx2(char *a, char *b, int n, int lim)
+{ __m256i four = _mm256_set1_epi8(4);
+  __m256i va, vb;
+  uint32  stop;
+
+  while (n+32 <= lim)
+    { va   = _mm256_loadu_si256((__m256i *) (a-(n+31)));
+      vb   = _mm256_loadu_si256((__m256i *) (b-(n+31)));
+      stop = ~ (uint32) _mm256_movemask_epi8(_mm256_cmpeq_epi8(va,vb))
+           | (uint32) _mm256_movemask_epi8(_mm256_cmpeq_epi8(vb,four));
+      if (stop != 0)
+        return (n + __builtin_clz(stop));
+      n += 32;
+    }
+  while (b[-n] != 4 && a[-n] == b[-n])
+    n += 1;
+  return (n);
+}
+
+static inline int forward_snake(char *a, char *b, char *aend, char *bend)
+{ __m128i four = _mm_set1_epi8(4);
+  __m128i va, vb;
+  uint32  stop;
+  int     n, lim;
+
+  for (n = 0; n < SNAKE_PROBE; n++)
+    if (b[n] == 4 || a[n] != b[n])
+      return (n);
+  lim = (aend-a < bend-b ? aend-a : bend-b) + 1;    //  a[0..lim) and b[0..lim) may be read
+  while (n+16 <= lim)
+    { va   = _mm_loadu_si128((__m128i *) (a+n));
+      vb   = _mm_loadu_si128((__m128i *) (b+n));
+      stop = (0xffff ^ (uint32) _mm_movemask_epi8(_mm_cmpeq_epi8(va,vb)))
+           | (uint32) _mm_movemask_epi8(_mm_cmpeq_epi8(vb,four));
+      if (stop != 0)
+        return (n + __builtin_ctz(stop));
+      n += 16;
+      if (Snake_AVX2)
+        return (forward_snake_avx2(a,b,n,lim));
+    }
+  while (b[n] != 4 && a[n] == b[n])
+    n += 1;
+  return (n);
+}
+
+static inline int reverse_snake(char *a, char *b, char *abeg, char *bbeg)
+{ __m128i four = _mm_set1_epi8(4);
+  __m128i va, vb;
+  uint32  stop;
+  int     n, lim;
+
+  for (n = 0; n < SNAKE_PROBE; n++)
+    if (b[-n] == 4 || a[-n] != b[-n])
+      return (n);
+  lim = (a-abeg < b-bbeg ? a-abeg : b-bbeg) + 1;    //  a(-lim..0] and b(-lim..0] may be read
+  while (n+16 <= lim)
+    { va   = _mm_loadu_si128((__m128i *) (a-(n+15)));
+      vb   = _mm_loadu_si128((__m128i *) (b-(n+15)));
+      stop = (0xffff ^ (uint32) _mm_movemask_epi8(_mm_cmpeq_epi8(va,vb)))
+           | (uint32) _mm_movemask_epi8(_mm_cmpeq_epi8(vb,four));
+      if (stop != 0)
+        return (n + (__builtin_clz(stop) - 16));
+      n += 16;
+      if (Snake_AVX2)
+        return (reverse_snake_avx2(a,b,n,lim));
+    }
+  while (b[-n] != 4 && a[-n] == b[-n])
+    n += 1;
+  return (n);
+}
+
+  //  Advance the match bit-vector b and its count m of 0-bits in the top PATH_LEN positions
+  //    over a run of len matches exactly as len steps of the scalar snake would.  The bits
+  //    examined are the top min(len,PATH_LEN+1) of b, short runs count them with Pop8.
+
+static uint8 Pop8[256] =
+#define P2(n)  n, n+1, n+1, n+2
+#define P4(n)  P2(n), P2(n+1), P2(n+1), P2(n+2)
+#define P6(n)  P4(n), P4(n+1), P4(n+1), P4(n+2)
+  { P6(0), P6(1), P6(1), P6(2) };
+
+static inline void snake_bits(BVEC *b, int *m, int len)
+{ BVEC x = *b;
+  int  j;
+
+  if (len <= 8)
+    *m += len - Pop8[(x >> (PATH_LEN+1-len)) & ((1 << len) - 1)];
+  else
+    { j = len;
+      if (j > PATH_LEN+1)
+        j = PATH_LEN+1;
+      *m += j - __builtin_popcountll((x >> (PATH_LEN+1-j)) & ((1ull << j) - 1));
+    }
+  if (len >= 64)
+    *b = ~0ull;
+  else
+    *b = (x << len) | ((1ull << len) - 1);
+}
+
+#endif
+
 /* At each furthest reaching point, keep a-coordinate of point (V), bitvector
      recording the last TRIM_LEN columns of the implied alignment (T), and the
      # of matches (1-bits) in the bitvector (M).                               */
@@ -346,6 +556,70 @@ typedef struct
 
 static int VectorEl = 6*sizeof(int) + sizeof(BVEC);
 
+static Pebble *enlarge_cells(_Work_Data *work, int cmax)
+{ return ((Pebble *) regrow(work,work->cells,work->celmax*sizeof(Pebble),cmax*sizeof(Pebble),
+                            "Reallocating trace cells"));
+}
+
+//  New_Work_Data_Sized places in one arena the buffers that Local_Alignment and Compute_Trace_PTS
+//    will grow to for reads of length up to maxlen: the wave vectors for Local_Alignment's
+//    initial band of 10,000 diagonals (or for a trace point segment with twice the average
+//    error rate of spec if larger), 10,000 pebble cells, the trace point vectors of a path
+//    spanning maxlen, and an exact trace of maxlen indels.  Each is sized as the enlarge
+//    routine that would otherwise allocate it on first use.
+
+#define ARENA_ROUND(x)  (((x) + 63) & ~((int64) 63))
+
+Work_Data *New_Work_Data_Sized(int maxlen, Align_Spec *spec)
+{ _Work_Data *work;
+  char       *arena;
+  int64       vmax, cmax, pmax, tmax;
+  int64       s;
+  int         tspace, maxtp;
+  int         dmax, nmax;
+  double      erate;
+
+  work = (_Work_Data *) New_Work_Data();
+  if (work == NULL)
+    EXIT(NULL);
+
+  tspace = Trace_Spacing(spec);
+  erate  = (1. - Average_Correlation(spec))/2.;
+
+  vmax = VectorEl*10000;
+  dmax = (int) (4.*erate*tspace) + 1;
+  nmax = (int) ((1.+2.*erate)*tspace) + 1;
+  s    = (dmax+3)*2*((tspace+nmax+3)*sizeof(int) + sizeof(int *));
+  if (s > vmax)
+    vmax = s;
+  vmax = ARENA_ROUND(((int64) (vmax*1.2)) + 10000);
+
+  cmax = ARENA_ROUND(10000*sizeof(Pebble));
+
+  maxtp = 2*(maxlen/tspace+2);
+  pmax  = ARENA_ROUND(4*maxtp*sizeof(uint16) + sizeof(Path));
+
+  tmax  = ARENA_ROUND(maxlen*sizeof(int));
+
+  arena = (char *) Malloc(vmax+cmax+pmax+tmax,"Allocating work data arena");
+  if (arena == NULL)
+    { free(work);
+      EXIT(NULL);
+    }
+
+  work->arena  = arena;
+  work->arnlen = vmax+cmax+pmax+tmax;
+  work->vecmax = vmax;
+  work->vector = arena;
+  work->celmax = cmax/sizeof(Pebble);
+  work->cells  = arena + vmax;
+  work->pntmax = pmax;
+  work->points = arena + (vmax+cmax);
+  work->tramax = tmax;
+  work->trace  = arena + (vmax+cmax+pmax);
+  return ((Work_Data *) work);
+}
+
 static int forward_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, Path *bpath,
                         int *mind, int maxd, int mida, int minp, int maxp, int aoff, int boff)
 { char *aseq  = align->aseq;
@@ -440,7 +714,7 @@ static int forward_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, P
 
         if (avail >= cmax-1)
           { cmax  = ((int) (avail*1.2)) + 10000;
-            cells = (Pebble *) Realloc(cells,cmax*sizeof(Pebble),"Reallocating trace cells");
+            cells = enlarge_cells(work,cmax);
             if (cells == NULL)
               EXIT(1);
             work->celmax = cmax;
@@ -471,6 +745,10 @@ static int forward_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, P
         hb  = avail++;
         nb += TRACE_SPACE;
 
+#ifdef SIMD_SNAKE
+        if (spec->snake)
+          y += forward_snake(a+y,bseq+y,aseq+align->alen,bseq+align->blen);
+#endif
         while (1)
           { c = bseq[y];
             if (c == 4)
@@ -494,7 +772,7 @@ static int forward_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, P
         while (y+k >= na)
           { if (avail >= cmax)
               { cmax  = ((int) (avail*1.2)) + 10000;
-                cells = (Pebble *) Realloc(cells,cmax*sizeof(Pebble),"Reallocating trace cells");
+                cells = enlarge_cells(work,cmax);
                 if (cells == NULL)
                   EXIT(1);
                 work->celmax = cmax;
@@ -514,7 +792,7 @@ static int forward_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, P
         while (y >= nb)
           { if (avail >= cmax)
               { cmax  = ((int) (avail*1.2)) + 10000;
-                cells = (Pebble *) Realloc(cells,cmax*sizeof(Pebble),"Reallocating trace cells");
+                cells = enlarge_cells(work,cmax);
                 if (cells == NULL)
                   EXIT(1);
                 work->celmax = cmax;
@@ -741,6 +1019,15 @@ static int forward_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, P
           b <<= 1;
 
           y = (c-k) >> 1;
+#ifdef SIMD_SNAKE
+          if (spec->snake)
+            { int len = forward_snake(a+y,bseq+y,aseq+align->alen,bseq+align->blen);
+              if (len > 0)
+                { y += len;
+                  snake_bits(&b,&m,len);
+                }
+            }
+#endif
           while (1)
             { c = bseq[y];
               if (c == 4)
@@ -768,8 +1055,7 @@ static int forward_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, P
             { if (cells[ha].mark < NA[k])
                 { if (avail >= cmax)
                     { cmax  = ((int) (avail*1.2)) + 10000;
-                      cells = (Pebble *) Realloc(cells,cmax*sizeof(Pebble),
-                                                       "Reallocating trace cells");
+                      cells = enlarge_cells(work,cmax);
                       if (cells == NULL)
                         EXIT(1);
                       work->celmax = cmax;
@@ -792,8 +1078,7 @@ static int forward_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, P
             { if (cells[hb].mark < NB[k])
                 { if (avail >= cmax)
                     { cmax  = ((int) (avail*1.2)) + 10000;
-                      cells = (Pebble *) Realloc(cells,cmax*sizeof(Pebble),
-                                                       "Reallocating trace cells");
+                      cells = enlarge_cells(work,cmax);
                       if (cells == NULL)
                         EXIT(1);
                       work->celmax = cmax;
@@ -1100,7 +1385,7 @@ static int reverse_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, P
 
         if (avail >= cmax-1)
           { cmax  = ((int) (avail*1.2)) + 10000;
-            cells = (Pebble *) Realloc(cells,cmax*sizeof(Pebble),"Reallocating trace cells");
+            cells = enlarge_cells(work,cmax);
             if (cells == NULL)
               EXIT(1);
             work->celmax = cmax;
@@ -1129,6 +1414,10 @@ static int reverse_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, P
         pb->mark = y;
         hb  = avail++;
 
+#ifdef SIMD_SNAKE
+        if (spec->snake)
+          y -= reverse_snake(a+y,bseq+y,aseq,bseq);
+#endif
         while (1)
           { c = bseq[y];
             if (c == 4)
@@ -1152,7 +1441,7 @@ static int reverse_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, P
         while (y+k <= na)
           { if (avail >= cmax)
               { cmax  = ((int) (avail*1.2)) + 10000;
-                cells = (Pebble *) Realloc(cells,cmax*sizeof(Pebble),"Reallocating trace cells");
+                cells = enlarge_cells(work,cmax);
                 if (cells == NULL)
                   EXIT(1);
                 work->celmax = cmax;
@@ -1172,7 +1461,7 @@ static int reverse_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, P
         while (y <= nb)
           { if (avail >= cmax)
               { cmax  = ((int) (avail*1.2)) + 10000;
-                cells = (Pebble *) Realloc(cells,cmax*sizeof(Pebble),"Reallocating trace cells");
+                cells = enlarge_cells(work,cmax);
                 if (cells == NULL)
                   EXIT(1);
                 work->celmax = cmax;
@@ -1396,6 +1685,15 @@ static int reverse_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, P
           b <<= 1;
 
           y = (c-k) >> 1;
+#ifdef SIMD_SNAKE
+          if (spec->snake)
+            { int len = reverse_snake(a+y,bseq+y,aseq,bseq);
+              if (len > 0)
+                { y -= len;
+                  snake_bits(&b,&m,len);
+                }
+            }
+#endif
           while (1)
             { c = bseq[y];
               if (c == 4)
@@ -1423,8 +1721,7 @@ static int reverse_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, P
             { if (cells[ha].mark > NA[k])
                 { if (avail >= cmax)
                     { cmax  = ((int) (avail*1.2)) + 10000;
-                      cells = (Pebble *) Realloc(cells,cmax*sizeof(Pebble),
-                                                       "Reallocating trace cells");
+                      cells = enlarge_cells(work,cmax);
                       if (cells == NULL)
                         EXIT(1);
                       work->celmax = cmax;
@@ -1446,8 +1743,7 @@ static int reverse_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, P
             { if (cells[hb].mark > NB[k])
                 { if (avail >= cmax)
                     { cmax  = ((int) (avail*1.2)) + 10000;
-                      cells = (Pebble *) Realloc(cells,cmax*sizeof(Pebble),
-                                                       "Reallocating trace cells");
+                      cells = enlarge_cells(work,cmax);
                       if (cells == NULL)
                         EXIT(1);
                       work->celmax = cmax;
@@ -1998,7 +2294,7 @@ static int forward_extend(_Work_Data *work, _Align_Spec *spec, Alignment *align,
 
         if (avail >= cmax-1)
           { cmax  = ((int) (avail*1.2)) + 10000;
-            cells = (Pebble *) Realloc(cells,cmax*sizeof(Pebble),"Reallocating trace cells");
+            cells = enlarge_cells(work,cmax);
             if (cells == NULL)
               EXIT(1);
             work->celmax = cmax;
@@ -2017,6 +2313,10 @@ static int forward_extend(_Work_Data *work, _Align_Spec *spec, Alignment *align,
         ha  = avail++;
         na += TRACE_SPACE;
 
+#ifdef SIMD_SNAKE
+        if (spec->snake)
+          y += forward_snake(a+y,bseq+y,aseq+align->alen,bseq+align->blen);
+#endif
         while (1)
           { c = bseq[y];
             if (c == 4)
@@ -2040,7 +2340,7 @@ static int forward_extend(_Work_Data *work, _Align_Spec *spec, Alignment *align,
         while (y+k >= na)
           { if (avail >= cmax)
               { cmax  = ((int) (avail*1.2)) + 10000;
-                cells = (Pebble *) Realloc(cells,cmax*sizeof(Pebble),"Reallocating trace cells");
+                cells = enlarge_cells(work,cmax);
                 if (cells == NULL)
                   EXIT(1);
                 work->celmax = cmax;
@@ -2237,6 +2537,15 @@ static int forward_extend(_Work_Data *work, _Align_Spec *spec, Alignment *align,
           b <<= 1;
 
           y = (c-k) >> 1;
+#ifdef SIMD_SNAKE
+          if (spec->snake)
+            { int len = forward_snake(a+y,bseq+y,aseq+align->alen,bseq+align->blen);
+              if (len > 0)
+                { y += len;
+                  snake_bits(&b,&m,len);
+                }
+            }
+#endif
           while (1)
             { c = bseq[y];
               if (c == 4)
@@ -2264,8 +2573,7 @@ static int forward_extend(_Work_Data *work, _Align_Spec *spec, Alignment *align,
             { if (cells[ha].mark < NA[k])
                 { if (avail >= cmax)
                     { cmax  = ((int) (avail*1.2)) + 10000;
-                      cells = (Pebble *) Realloc(cells,cmax*sizeof(Pebble),
-                                                       "Reallocating trace cells");
+                      cells = enlarge_cells(work,cmax);
                       if (cells == NULL)
                         EXIT(1);
                       work->celmax = cmax;
@@ -2510,7 +2818,7 @@ static int reverse_extend(_Work_Data *work, _Align_Spec *spec, Alignment *align,
 
         if (avail >= cmax-1)
           { cmax  = ((int) (avail*1.2)) + 10000;
-            cells = (Pebble *) Realloc(cells,cmax*sizeof(Pebble),"Reallocating trace cells");
+            cells = enlarge_cells(work,cmax);
             if (cells == NULL)
               EXIT(1);
             work->celmax = cmax;
@@ -2528,6 +2836,10 @@ static int reverse_extend(_Work_Data *work, _Align_Spec *spec, Alignment *align,
         pb->mark = y+k;
         ha  = avail++;
 
+#ifdef SIMD_SNAKE
+        if (spec->snake)
+          y -= reverse_snake(a+y,bseq+y,aseq,bseq);
+#endif
         while (1)
           { c = bseq[y];
             if (c == 4)
@@ -2551,7 +2863,7 @@ static int reverse_extend(_Work_Data *work, _Align_Spec *spec, Alignment *align,
         while (y+k <= na)
           { if (avail >= cmax)
               { cmax  = ((int) (avail*1.2)) + 10000;
-                cells = (Pebble *) Realloc(cells,cmax*sizeof(Pebble),"Reallocating trace cells");
+                cells = enlarge_cells(work,cmax);
                 if (cells == NULL)
                   EXIT(1);
                 work->celmax = cmax;
@@ -2745,6 +3057,15 @@ static int reverse_extend(_Work_Data *work, _Align_Spec *spec, Alignment *align,
           b <<= 1;
 
           y = (c-k) >> 1;
+#ifdef SIMD_SNAKE
+          if (spec->snake)
+            { int len = reverse_snake(a+y,bseq+y,aseq,bseq);
+              if (len > 0)
+                { y -= len;
+                  snake_bits(&b,&m,len);
+                }
+            }
+#endif
           while (1)
             { c = bseq[y];
               if (c == 4)
@@ -2772,8 +3093,7 @@ static int reverse_extend(_Work_Data *work, _Align_Spec *spec, Alignment *align,
             { if (cells[ha].mark > NA[k])
                 { if (avail >= cmax)
                     { cmax  = ((int) (avail*1.2)) + 10000;
-                      cells = (Pebble *) Realloc(cells,cmax*sizeof(Pebble),
-                                                       "Reallocating trace cells");
+                      cells = enlarge_cells(work,cmax);
                       if (cells == NULL)
                         EXIT(1);
                       work->celmax = cmax;
@@ -3947,6 +4267,8 @@ typedef struct
     int   mida,  midb;   //  mid point division for mid-point algorithms
 
     int   *VF,   *VB;    //  Forward/Reverse waves for nd algorithms
+
+    _Work_Data *work;    //  Holds the columns of bit_np
   } Trace_Waves;
 
 static int split_nd(char *A, int M, char *B, int N, Trace_Waves *wave, int *px, int *py)
@@ -4487,12 +4809,152 @@ static int ToA[4] = { 'a', 'c', 'g', 't' };
 static char *TP_Align =
          "Bad alignment between trace points (Compute_Trace), source DB likely incorrect";
 
+/* Bit-parallel alternative to iter_np for the mode BITPARALLEL (Myers 1999, in the global
+     form of Hyyro 2004).  Bit i of the words of a column stands for row i+1 of the unit-cost
+     edit distance matrix between A (rows) and B (columns), so that a column of up to 64W rows
+     is advanced in O(W) word operations.  Pv/Mv mark a +1/-1 difference of a cell with the
+     one above it and Ph/Mh with the one to its left.  All are kept for every column so that
+     the traceback from (M,N) knows the value of each neighbor of a cell, taking the diagonal
+     if it can, then a deletion, then an insertion.  The number of differences is the same as
+     found by iter_np, but among equally good alignments the one chosen may differ.
+*/
+
+#define BIT_OF(V,r)  (((V)[(r) >> 6] >> ((r) & 0x3f)) & 0x1)
+
+static int bit_np(char *A, int M, char *B, int N, Trace_Waves *wave)
+{ _Work_Data *work = wave->work;
+  uint64     *Peq, *Pv, *Mv, *Ph, *Mh;
+  int         W, i, j, w;
+  int         d, e;
+  int         ap, bp;
+  int        *stop;
+
+  W = (M+63) >> 6;
+  if (W == 0)
+    W = 1;
+  i = (5 + 4*(N+1))*W*sizeof(uint64);
+  if (i > work->bitmax)
+    if (enlarge_bitvec(work,i))
+      EXIT(-1);
+  Peq = (uint64 *) work->bitvec;
+  Pv  = Peq + 5*W;
+  Mv  = Pv + (N+1)*W;
+  Ph  = Mv + (N+1)*W;
+  Mh  = Ph + (N+1)*W;
+
+  bzero(Peq,5*W*sizeof(uint64));
+  for (i = 0; i < M; i++)
+    if ((uint8) A[i] <= 4)
+      Peq[A[i]*W + (i >> 6)] |= (1ull << (i & 0x3f));
+
+  for (w = 0; w < W; w++)
+    { Pv[w] = ~0ull;
+      Mv[w] = 0;
+    }
+
+  //  Column j from column j-1, the horizontal difference into row 0 is always +1
+
+  e = 0;
+  for (j = 1; j <= N; j++)
+    { uint64 *eq, *pv, *mv, *ph, *mh;
+      uint64  Eq, Xv, Xh, P, Q, X, Y;
+      uint64  hneg, hpos;
+      int     hin;
+
+      if ((uint8) B[j-1] <= 4)
+        eq = Peq + B[j-1]*W;
+      else
+        eq = Peq + 4*W;
+      pv  = Pv + (j-1)*W;
+      mv  = Mv + (j-1)*W;
+      ph  = Ph + j*W;
+      mh  = Mh + j*W;
+      hin = 1;
+      for (w = 0; w < W; w++)
+        { P  = pv[w];
+          Q  = mv[w];
+          Eq = eq[w];
+          hneg = (hin < 0);
+          hpos = (hin > 0);
+          Xv = Eq | Q;
+          Eq |= hneg;
+          Xh = (((Eq & P) + P) ^ P) | Eq;
+          X  = ph[w] = Q | ~ (Xh | P);
+          Y  = mh[w] = P & Xh;
+          hin = ((int) (X >> 63)) - ((int) (Y >> 63));
+          X = (X << 1) | hpos;
+          Y = (Y << 1) | hneg;
+          pv[W+w] = Y | ~ (Xv | X);
+          mv[W+w] = X & Xv;
+        }
+      if (M > 0)
+        e += (int) BIT_OF(ph,M-1) - (int) BIT_OF(mh,M-1);
+      else
+        e += 1;
+    }
+  e += M;
+
+  //  Trace back from (M,N) with d = D(i,j), pushing indels in reverse order
+
+  ap = (A - wave->Aabs) + 1;
+  bp = (B - wave->Babs) + 1;
+  stop = wave->Stop;
+
+  i = M;
+  j = N;
+  d = e;
+  while (i > 0 && j > 0)
+    { int u, g;
+
+      u = d - ((int) BIT_OF(Pv+j*W,i-1) - (int) BIT_OF(Mv+j*W,i-1));     //  D(i-1,j)
+      if (i > 1)
+        g = u - ((int) BIT_OF(Ph+j*W,i-2) - (int) BIT_OF(Mh+j*W,i-2));   //  D(i-1,j-1)
+      else
+        g = u - 1;
+      if (g + (A[i-1] != B[j-1]) == d)
+        { d = g;
+          i -= 1;
+          j -= 1;
+        }
+      else if (u + 1 == d)
+        { *wave->Stop++ = bp + j;
+          d = u;
+          i -= 1;
+        }
+      else
+        { *wave->Stop++ = - (ap + i);
+          d -= 1;
+          j -= 1;
+        }
+    }
+  while (i > 0)
+    *wave->Stop++ = bp + (i--,j);
+  while (j > 0)
+    { *wave->Stop++ = - (ap + i);
+      j -= 1;
+    }
+
+  { int *s, *t, x;
+
+    for (s = stop, t = wave->Stop-1; s < t; s++, t--)
+      { x  = *s;
+        *s = *t;
+        *t = x;
+      }
+  }
+
+  return (e);
+}
+
 static int iter_np(char *A, int M, char *B, int N, Trace_Waves *wave, int mode, int dmax)
 { int  **PVF = wave->PVF; 
   int  **PHF = wave->PHF;
   int    D;
   int    del = M-N;
 
+  if (mode == BITPARALLEL && wave->Aabs != wave->Babs)
+    return (bit_np(A,M,B,N,wave));
+
   { int  *F0, *F1, *F2;
     int  *HF;
     int   low, hgh;
@@ -5175,6 +5637,7 @@ int Compute_Trace_PTS(Alignment *align, Work_Data *ework, int trace_spacing, int
   }
 
   wave.Stop = (int *) (work->trace);
+  wave.work = work;
   wave.Aabs = aseq;
   wave.Babs = bseq;
 
@@ -5285,6 +5748,7 @@ int Compute_Trace_MID(Alignment *align, Work_Data *ework, int trace_spacing, int
   }
 
   wave.Stop = ((int *) work->trace);
+  wave.work = work;
   wave.Aabs = aseq;
   wave.Babs = bseq;
 
@@ -5421,6 +5885,7 @@ int Compute_Trace_IRR(Alignment *align, Work_Data *ework, int mode)
   }
 
   wave.Stop = (int *) (work->trace);
+  wave.work = work;
   wave.Aabs = aseq;
   wave.Babs = bseq;
 
@@ -5451,3 +5916,101 @@ int Compute_Trace_IRR(Alignment *align, Work_Data *ework, int mode)
 
   return (0);
 }
+
+
+/****************************************************************************************\
+*                                                                                        *
+*  COMPUTE THE TRACES OF A BATCH OF ALIGNMENTS IN PARALLEL                               *
+*                                                                                        *
+\****************************************************************************************/
+
+//  Variables shared by the threads of a batch, and the control record of each thread
+
+typedef struct
+  { int             n;       //  Compute the traces of align[0..n-1]
+    Alignment      *align;
+    int           **trace;   //  into trace[0..n-1]
+    int             tspace;
+    int             mode;
+    int             next;    //  Index of the next alignment to hand out
+    pthread_mutex_t lock;    //  Guards next
+  } Trace_Batch;
+
+typedef struct
+  { Trace_Batch *batch;
+    Work_Data   *work;
+    int          error;      //  Set if a trace computation failed
+  } Batch_Arg;
+
+static void *batch_thread(void *arg)
+{ Batch_Arg   *data  = (Batch_Arg *) arg;
+  Trace_Batch *batch = data->batch;
+  Work_Data   *work  = data->work;
+
+  Alignment *align;
+  Path      *path;
+  int        i, err;
+
+  while (1)
+    { pthread_mutex_lock(&batch->lock);
+      i = batch->next++;
+      pthread_mutex_unlock(&batch->lock);
+      if (i >= batch->n)
+        break;
+
+      align = batch->align + i;
+      if (batch->tspace == 0)
+        err = Compute_Trace_IRR(align,work,batch->mode);
+      else
+        err = Compute_Trace_PTS(align,work,batch->tspace,batch->mode);
+      if (err)
+        { data->error = 1;
+          continue;
+        }
+
+      path = align->path;
+      memcpy(batch->trace[i],path->trace,sizeof(int)*path->tlen);
+      path->trace = batch->trace[i];
+    }
+  return (NULL);
+}
+
+int Compute_Trace_Batch(int n, Alignment *align, int **trace, Work_Data **work,
+                        int nthreads, int trace_spacing, int mode)
+{ pthread_t   threads[nthreads];
+  Batch_Arg   parmx[nthreads];
+  Trace_Batch batch;
+  int         i, err;
+
+  if (nthreads > n)
+    nthreads = n;
+  if (nthreads <= 0)
+    return (0);
+
+  batch.n      = n;
+  batch.align  = align;
+  batch.trace  = trace;
+  batch.tspace = trace_spacing;
+  batch.mode   = mode;
+  batch.next   = 0;
+  pthread_mutex_init(&batch.lock,NULL);
+
+  for (i = 0; i < nthreads; i++)
+    { parmx[i].batch = &batch;
+      parmx[i].work  = work[i];
+      parmx[i].error = 0;
+    }
+
+  for (i = 1; i < nthreads; i++)
+    pthread_create(threads+i,NULL,batch_thread,parmx+i);
+  batch_thread(parmx);
+  for (i = 1; i < nthreads; i++)
+    pthread_join(threads[i],NULL);
+
+  pthread_mutex_destroy(&batch.lock);
+
+  err = 0;
+  for (i = 0; i < nthreads; i++)
+    err |= parmx[i].error;
+  return (err);
+}
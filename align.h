@@ -167,6 +167,20 @@ void Complement_Seq(char *a, int n);
 
   void       Free_Work_Data(Work_Data *work);
 
+  /* New_Work_Data_Sized creates a Work_Data whose storage for aligning reads of length up to
+     maxlen under the parameters of spec (see below) is allocated up front in a single block,
+     so that a thread rarely has to enlarge it with Local_Alignment or Compute_Trace.  Storage
+     that must nevertheless grow moves out of the block as usual.  Work_Data_Enlargements
+     returns how many times any of the storage of work has been allocated to a larger size,
+     which for a Work_Data from New_Work_Data includes the first allocation of each piece.
+  */
+
+  typedef void Align_Spec;
+
+  Work_Data *New_Work_Data_Sized(int maxlen, Align_Spec *spec);
+
+  int64      Work_Data_Enlargements(Work_Data *work);
+
   /* Local_Alignment seeks local alignments of a quality determined by a number of parameters.
      These are coded in an Align_Spec object that can be created with New_Align_Spec and
      freed with Free_Align_Spec when no longer needed.  There are 4 essential parameters:
@@ -191,8 +205,6 @@ void Complement_Seq(char *a, int n);
      utility functions below.
   */
 
-  typedef void Align_Spec;
-
   Align_Spec *New_Align_Spec(double ave_corr, int trace_space, float *freq, int reach);
 
   void        Free_Align_Spec(Align_Spec *spec);
@@ -248,11 +260,18 @@ void Complement_Seq(char *a, int n);
      by computing the trace between the mid-points of alignments between two adjacent pairs of trace
      points.  It is generally twice as slow as Compute_Trace_PTS, but it produces nearer optimal
      alignments.  Both these routines return 1 if an error occurred and 0 otherwise.
+
+     With mode BITPARALLEL the alignment between each pair of points is computed with a
+     bit-parallel edit distance kernel instead of the O(np) wave algorithm.  It finds the same
+     number of differences, and is faster on noisy segments, but which of several equally good
+     alignments is reported may differ from the other modes.  A comparison of a read against
+     itself always uses the wave algorithm in mode GREEDIEST.
   */
 
-#define LOWERMOST -1   //   Possible modes for "mode" parameter below)
-#define GREEDIEST  0
-#define UPPERMOST  1
+#define LOWERMOST   -1   //   Possible modes for "mode" parameter below)
+#define GREEDIEST    0
+#define UPPERMOST    1
+#define BITPARALLEL  2
 
   int Compute_Trace_PTS(Alignment *align, Work_Data *work, int trace_spacing, int mode);
   int Compute_Trace_MID(Alignment *align, Work_Data *work, int trace_spacing, int mode);
@@ -266,6 +285,19 @@ void Complement_Seq(char *a, int n);
 
   int Compute_Trace_IRR(Alignment *align, Work_Data *work, int mode);   //  experimental !!
 
+  /* Compute_Trace_Batch computes the exact traces of the n alignments align[0..n-1] with
+     nthreads threads, the t'th of which uses work[t].  Each alignment must be set up as for
+     Compute_Trace_PTS, or for Compute_Trace_IRR if trace_spacing is 0.  As the trace of a
+     Work_Data packet is overwritten by the next call, the trace of align[i] is copied to the
+     caller's array trace[i], which must hold (aepos-abpos) + (bepos-bbpos) integers, and
+     'align[i].path->trace' is set to point at it.  The alignments are handed out to the
+     threads one at a time so that a few long ones do not hold up the rest.  1 is returned
+     if an error occurred in any of the threads and 0 otherwise.
+  */
+
+  int Compute_Trace_Batch(int n, Alignment *align, int **trace, Work_Data **work,
+                          int nthreads, int trace_spacing, int mode);
+
   /* Compute Alignment determines the best alignment between the substrings specified by align.
      If the task is DIFF_ONLY, then only the difference of this alignment is computed and placed
      in the "diffs" field of align's path.  If the task is PLUS_TRACE or DIFF_TRACE, then
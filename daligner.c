@@ -40,6 +40,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <pthread.h>
 
 #include <sys/param.h>
 #if defined(BSD)
@@ -51,10 +52,10 @@
 #include "filter.h"
 
 static char *Usage[] =
-  { "[-vaABI] [-k<int(16)>] [-%<int(28)>] [-h<int(50)>] [-w<int(6)>] [-t<int>] [-M<int>]",
-    "         [-e<double(.75)] [-l<int(1500)>] [-s<int(100)>] [-H<int>]",
-    "         [-T<int(4)>] [-P<dir(/tmp)>] [-m<track>]+",
-    "         <subject:db|dam> <target:db|dam> ...",
+  { "[-vaABICORKFcDL] [-k<int(16)>] [-%<int(28)>] [-W<int>] [-h<int(50)>] [-w<int(6)>] [-t<int>]",
+    "          [-b<int>] [-M<int>] [-S<int>] [-e<double(.75)] [-l<int(1500)>] [-s<int(100)>]",
+    "          [-H<int>] [-p<int>] [-T<int(4)>] [-P<dir(/tmp)>] [-m<track>]+",
+    "          <subject:db|dam> <target:db|dam> ...",
   };
 
 int     VERBOSE;   //   Globally visible to filter.c
@@ -63,10 +64,20 @@ int     HGAP_MIN;
 int     SYMMETRIC;
 int     IDENTITY;
 int     BRIDGE;
+int     ONE_PASS;
+int     SUBSAMPLE;
+int     CODE_COUNTS;
+int     CHAIN_SEEDS;
+int     MAP_ORDER;
+int     MEMORY_SORT;
 char   *SORT_PATH;
+int     DIRECT_IO;
 
 uint64  MEM_LIMIT;
 uint64  MEM_PHYSICAL;
+uint64  MEM_RESERVE;
+int     SLICE_SIZE;
+int     PANEL_LEN;
 
 /*  Adapted from code by David Robert Nadeau (http://NadeauSoftware.com) licensed under
  *     "Creative Commons Attribution 3.0 Unported License"
@@ -418,6 +429,123 @@ static int read_DB(DAZZ_DB *block, char *name, char **mask, int *mstat, int mtop
   return (isdam);
 }
 
+  //  A stamp for the state of a block: its place in the DB, the size and modification time
+  //    of the DB's .idx and .bps files, and the contents of the mask track (if any).
+
+#define FNV_MIX(h,v)  { h ^= (uint64) (v); h *= 0x100000001b3llu; }
+
+static uint64 block_stamp(DAZZ_DB *block)
+{ struct stat sbuf;
+  uint64      h;
+
+  h = 0xcbf29ce484222325llu;
+  FNV_MIX(h,block->part)
+  FNV_MIX(h,block->tfirst)
+  FNV_MIX(h,block->nreads)
+  FNV_MIX(h,block->totlen)
+
+  if (stat(Catenate(block->path,"","",".idx"),&sbuf) == 0)
+    { FNV_MIX(h,sbuf.st_size)
+      FNV_MIX(h,sbuf.st_mtime)
+    }
+  if (stat(Catenate(block->path,"","",".bps"),&sbuf) == 0)
+    { FNV_MIX(h,sbuf.st_size)
+      FNV_MIX(h,sbuf.st_mtime)
+    }
+
+  if (block->tracks != NULL)
+    { int64 *anno = (int64 *) (block->tracks->anno);
+      int   *data = (int *) (block->tracks->data);
+      int64  i;
+
+      for (i = 0; i <= block->nreads; i++)
+        FNV_MIX(h,anno[i])
+      for (i = anno[0]; i < anno[block->nreads]; i++)
+        FNV_MIX(h,data[i])
+    }
+
+  return (h);
+}
+
+  //  Build the index for block with nthreads threads, or if cache is set, map it from the
+  //    index file for the block if it is up to date, and otherwise build it and save it in
+  //    said file.  Progress is reported only if verbose is set.
+
+static void *index_block(DAZZ_DB *block, char *path, char *root, int cache, int64 *len,
+                         int nthreads, int verbose)
+{ char   *iname;
+  void   *index;
+  uint64  stamp;
+
+  if (verbose)
+    printf("\nBuilding index for %s\n",root);
+
+  if (! cache)
+    return (Sort_Kmers(block,len,nthreads,verbose));
+
+#ifdef HIDE_FILES
+  iname = Strdup(Catenate(path,"/.",root,".kidx"),"Allocating index file name");
+#else
+  iname = Strdup(Catenate(path,"/",root,".kidx"),"Allocating index file name");
+#endif
+  if (iname == NULL)
+    Clean_Exit(1);
+
+  stamp = block_stamp(block);
+  index = Load_Kmers(iname,block,stamp,len,verbose);
+  if (index == NULL)
+    { index = Sort_Kmers(block,len,nthreads,verbose);
+      Save_Kmers(iname,index,stamp,verbose);
+    }
+
+  free(iname);
+  return (index);
+}
+
+  //  With -F the target blocks are listed up front, and while one is compared the next is
+  //    read and indexed by a fetch_block thread.  Catenate's buffer is not shared with any
+  //    routine called by the main thread while it runs.  The fetch runs silently on
+  //    FETCH_THREADS of the -T threads, the comparison getting the rest, and the main thread
+  //    reports on the fetched block once it has joined the fetch.
+
+#define FETCH_THREADS(n)  ((n) >= 8 ? (n)/4 : 1)
+
+typedef struct
+  { char *root;
+    char *path;
+    int   self;       //  Target is the subject block
+  } Target;
+
+typedef struct
+  { DAZZ_DB *block;   //  Read block path/root into block
+    char    *path;
+    char    *root;
+    char   **mask;    //    with the masks and settings of read_DB and index_block
+    int     *mstat;
+    int      mtop;
+    int      kmer;
+    int      cache;
+    int      nthreads;
+    int      verbose;
+    void    *index;   //  and set its index and # of k-mers
+    int64    len;
+  } Fetch_Arg;
+
+static void *fetch_block(void *arg)
+{ Fetch_Arg *data = (Fetch_Arg *) arg;
+  char      *bfile;
+
+  bfile = Strdup(Catenate(data->path,"/",data->root,""),"Allocating path");
+  if (bfile == NULL)
+    Clean_Exit(1);
+  read_DB(data->block,bfile,data->mask,data->mstat,data->mtop,data->kmer);
+  free(bfile);
+
+  data->index = index_block(data->block,data->path,data->root,data->cache,&data->len,
+                            data->nthreads,data->verbose);
+  return (NULL);
+}
+
 static char *CommandBuffer(char *aname, char *bname, char *spath)
 { static char *cat = NULL;
   static int   max = -1;
@@ -448,13 +576,13 @@ void Clean_Exit(int val)
 }
 
 int main(int argc, char *argv[])
-{ DAZZ_DB    _ablock, _bblock;
-  DAZZ_DB    *ablock = &_ablock, *bblock = &_bblock;
-  char       *afile,  *bfile;
+{ DAZZ_DB    _ablock, _bblock[2];
+  DAZZ_DB    *ablock = &_ablock, *bblock = _bblock;
+  char       *afile;
   char       *apath,  *bpath;
   char       *aroot,  *broot;
   void       *aindex, *bindex;
-  int         alen,    blen;
+  int64       alen,    blen;
   Align_Spec *asettings;
   int         isdam;
   int         MMAX, MTOP, *MSTAT;
@@ -462,13 +590,16 @@ int main(int argc, char *argv[])
 
   int    KMER_LEN;
   int    MOD_THR;
+  int    MINI_WIN;
   int    BIN_SHIFT;
   int    MAX_REPS;
+  int    HIT_BUDGET;
   int    HIT_MIN;
   double AVE_ERROR;
   int    SPACING;
   int    NTHREADS;
-  int    MAP_ORDER;
+  int    KMER_CACHE;
+  int    PREFETCH;
 
   { int    i, j, k;
     int    flags[128];
@@ -479,9 +610,11 @@ int main(int argc, char *argv[])
 
     KMER_LEN  = 16;
     MOD_THR   = 28;
+    MINI_WIN  = 0;
     HIT_MIN   = 50;
     BIN_SHIFT = 6;
     MAX_REPS  = 0;
+    HIT_BUDGET = 0;
     HGAP_MIN  = 0;
     AVE_ERROR = .75;
     SPACING   = 100;
@@ -491,6 +624,8 @@ int main(int argc, char *argv[])
 
     MEM_PHYSICAL = getMemorySize();
     MEM_LIMIT    = MEM_PHYSICAL;
+    SLICE_SIZE   = 0;
+    PANEL_LEN    = 0;
     if (MEM_PHYSICAL == 0)
       { fprintf(stderr,"\nWarning: Could not get physical memory size\n");
         fflush(stderr);
@@ -508,7 +643,7 @@ int main(int argc, char *argv[])
       if (argv[i][0] == '-')
         switch (argv[i][1])
         { default:
-            ARG_FLAGS("vaBI")
+            ARG_FLAGS("vaBICORKFcDL")
             break;
           case 'k':
             ARG_POSITIVE(KMER_LEN,"K-mer length")
@@ -526,6 +661,9 @@ int main(int argc, char *argv[])
           case 't':
             ARG_POSITIVE(MAX_REPS,"Tuple supression frequency")
             break;
+          case 'b':
+            ARG_POSITIVE(HIT_BUDGET,"Hit budget (in millions)")
+            break;
           case 'H':
             ARG_POSITIVE(HGAP_MIN,"HGAP threshold (in bp.s)")
             break;
@@ -550,6 +688,12 @@ int main(int argc, char *argv[])
               MEM_LIMIT = limit * 0x40000000ll;
               break;
             }
+          case 'S':
+            ARG_POSITIVE(SLICE_SIZE,"Slice size (in millions of hits)")
+            break;
+          case 'p':
+            ARG_POSITIVE(PANEL_LEN,"Panel length (in bp.s)")
+            break;
           case 'm':
             if (MTOP >= MMAX)
               { MMAX  = 1.2*MTOP + 10;
@@ -575,6 +719,9 @@ int main(int argc, char *argv[])
           case '%':
             ARG_POSITIVE(MOD_THR,"Modimer percentage")
             break;
+          case 'W':
+            ARG_POSITIVE(MINI_WIN,"Minimizer window")
+            break;
         }
       else
         argv[j++] = argv[i];
@@ -584,7 +731,15 @@ int main(int argc, char *argv[])
     SYMMETRIC = 1-flags['A'];
     IDENTITY  = flags['I'];
     BRIDGE    = flags['B'];
+    ONE_PASS  = flags['O'];
+    SUBSAMPLE = flags['R'];
+    CODE_COUNTS = flags['K'];
+    CHAIN_SEEDS = flags['c'];
+    DIRECT_IO   = flags['D'];
+    MEMORY_SORT = flags['L'];
     MAP_ORDER = flags['a'];
+    KMER_CACHE = flags['C'];
+    PREFETCH   = flags['F'];
 
     if (argc <= 2)
       { fprintf(stderr,"Usage: %s %s\n",Prog_Name,Usage[0]);
@@ -594,21 +749,43 @@ int main(int argc, char *argv[])
         fprintf(stderr,"\n");
         fprintf(stderr,"      -k: k-mer size (must be <= 32).\n");
         fprintf(stderr,"      -%%: modimer percentage (take %% of the k-mers).\n");
+        fprintf(stderr,"      -W: Instead take the minimizers of every -W consecutive k-mers\n");
+        fprintf(stderr,"          (about 200/(W+1) %% of the k-mers).\n");
         fprintf(stderr,"      -w: Look for k-mers in averlapping bands of size 2^-w.\n");
         fprintf(stderr,"      -h: A seed hit if the k-mers in band cover >= -h bps in the");
         fprintf(stderr," targest read.\n");
         fprintf(stderr,"      -t: Ignore k-mers that occur >= -t times in a block.\n");
+        fprintf(stderr,"      -b: Ignore the most frequent k-mers of a block so that comparing it\n");
+        fprintf(stderr,"          to itself gives at most -b million k-mer hits.\n");
+        fprintf(stderr,"      -R: Keep an evenly spread sample of t-1 occurrences of each k-mer\n");
+        fprintf(stderr,"          that occurs >= t times, where t is set by -t or -b.\n");
         fprintf(stderr,"      -M: Use only -M GB of memory by ignoring most frequent k-mers.\n");
+        fprintf(stderr,"      -S: Process the subject block in slices of at most -S million\n");
+        fprintf(stderr,"          k-mer hits (and that fit -M), capping hits only if need be.\n");
         fprintf(stderr,"\n");
         fprintf(stderr,"      -e: Look for alignments with -e percent similarity.\n");
         fprintf(stderr,"      -l: Look for alignments of length >= -l.\n");
         fprintf(stderr,"      -s: The trace point spacing for encoding alignments.\n");
         fprintf(stderr,"      -B: Bridge consecutive aligned segments into one if possible\n");
+        fprintf(stderr,"      -c: Chain the colinear seeds of each read pair, and align from the\n");
+        fprintf(stderr,"          best seed of each chain first.\n");
         fprintf(stderr,"      -H: HGAP option: align only target reads of length >= -H.\n");
+        fprintf(stderr,"      -p: Score the k-mer hits of long subject reads in panels of -p bp.s\n");
+        fprintf(stderr,"          (default: the larger of 50000 and 1/8th of the longest read).\n");
         fprintf(stderr,"\n");
         fprintf(stderr,"      -T: Use -T threads.\n");
         fprintf(stderr,"      -P: Do block level sorts and merges in directory -P.\n");
+        fprintf(stderr,"      -D: Write the .las files in -P with O_DIRECT (where supported).\n");
+        fprintf(stderr,"      -L: Sort and merge the alignments in memory, using files in -P\n");
+        fprintf(stderr,"          only if they exceed the -M limit.\n");
         fprintf(stderr,"      -m: Soft mask the blocks with the specified mask.\n");
+        fprintf(stderr,"      -C: Cache the k-mer index of each block in a file next to the block\n");
+        fprintf(stderr,"          and reuse it in later runs with the same parameters.\n");
+        fprintf(stderr,"      -O: Build k-mer indices in one pass (faster, a little more memory).\n");
+        fprintf(stderr,"      -K: Keep the count of each distinct k-mer with an index, and count the\n");
+        fprintf(stderr,"          k-mer matches between two blocks from these.\n");
+        fprintf(stderr,"      -F: Fetch and index the next target block during the current comparison,\n");
+        fprintf(stderr,"          with 1/4 of the -T threads (at least 1, none if -T1).\n");
         fprintf(stderr,"\n");
         fprintf(stderr,"      -v: Verbose mode, output statistics as proceed.\n");
         fprintf(stderr,"      -a: sort .las by A-read,A-position pairs for map usecase\n");
@@ -620,7 +797,7 @@ int main(int argc, char *argv[])
   }
 
   MINOVER *= 2;
-  Set_Filter_Params(KMER_LEN,MOD_THR,BIN_SHIFT,MAX_REPS,HIT_MIN,NTHREADS);
+  Set_Filter_Params(KMER_LEN,MOD_THR,MINI_WIN,BIN_SHIFT,MAX_REPS,HIT_BUDGET,HIT_MIN,NTHREADS);
   Set_LSD_Params(NTHREADS,VERBOSE);
 
   // Create directory in SORT_PATH for file operations
@@ -650,36 +827,111 @@ int main(int argc, char *argv[])
 
   asettings = New_Align_Spec( AVE_ERROR, SPACING, ablock->freq, 1);
 
-  if (VERBOSE)
-    printf("\nBuilding index for %s\n",aroot);
-  aindex = Sort_Kmers(ablock,&alen);
+  aindex = index_block(ablock,apath,aroot,KMER_CACHE,&alen,NTHREADS,VERBOSE);
 
   // Compare against reads in B in both orientations
 
   { int           i, j;
+    int           ntarg, mtarg;
+    Target       *targ;
     Block_Looper *parse;
     char         *command;
-
+    Fetch_Arg     fetch;
+    pthread_t     fetcher;
+    int           pending;
+    int           merged;
+    uint64        reserve;
+
+    ntarg = mtarg = 0;
+    targ  = NULL;
     for (i = 2; i < argc; i++)
       { parse = Parse_Block_DB_Arg(argv[i]);
 
         while (Advance_Block_Arg(parse))
-          { broot = Block_Arg_Root(parse);
-            bpath = Block_Arg_Path(parse);
+          { if (ntarg >= mtarg)
+              { mtarg = 1.2*ntarg + 10;
+                targ  = (Target *) Realloc(targ,sizeof(Target)*mtarg,"Allocating target list");
+                if (targ == NULL)
+                  Clean_Exit(1);
+              }
+            targ[ntarg].root = Block_Arg_Root(parse);
+            targ[ntarg].path = Block_Arg_Path(parse);
+            targ[ntarg].self = (strcmp(targ[ntarg].root,aroot) == 0
+                                  && strcmp(targ[ntarg].path,apath) == 0);
+            ntarg += 1;
+          }
+
+        Free_Block_Arg(parse);
+      }
+
+    fetch.mask  = MASK;
+    fetch.mstat = MSTAT;
+    fetch.mtop  = MTOP;
+    fetch.kmer  = KMER_LEN;
+    fetch.cache = KMER_CACHE;
+
+    //  The memory set aside for a block being fetched is estimated from the last block read
 
-            if (strcmp(broot,aroot) != 0 || strcmp(bpath,apath) != 0)
-              { bfile = Strdup(Catenate(bpath,"/",broot,""),"Allocating path");
-                read_DB(bblock,bfile,MASK,MSTAT,MTOP,KMER_LEN);
-                free(bfile);
+    reserve = sizeof_DB(ablock) + Kmers_Space(alen);
+    pending = 0;
+    bindex  = NULL;
+    blen    = 0;
 
+    for (i = 0; i < ntarg; i++)
+      { broot = targ[i].root;
+        bpath = targ[i].path;
+
+        if ( ! targ[i].self)
+          { if (pending)
+              { pthread_join(fetcher,NULL);
+                pending = 0;
                 if (VERBOSE)
-                  printf("\nBuilding index for %s\n",broot);
-                bindex = Sort_Kmers(bblock,&blen);
-                Match_Filter(aroot,ablock,broot,bblock,aindex,alen,bindex,blen,asettings);
-                Close_DB(bblock);
+                  { printf("\nFetched %s and its index during the last comparison\n",broot);
+                    printf("   Kmer count = ");
+                    Print_Number(fetch.len,0,stdout);
+                    printf("\n");
+                    fflush(stdout);
+                  }
               }
             else
-              Match_Filter(aroot,ablock,aroot,ablock,aindex,alen,aindex,alen,asettings);
+              { fetch.block    = bblock;
+                fetch.path     = bpath;
+                fetch.root     = broot;
+                fetch.nthreads = NTHREADS;
+                fetch.verbose  = VERBOSE;
+                fetch_block(&fetch);
+              }
+            bblock = fetch.block;
+            bindex = fetch.index;
+            blen   = fetch.len;
+            reserve = sizeof_DB(bblock) + Kmers_Space(blen);
+          }
+
+        MEM_RESERVE = 0;
+        Set_Filter_Threads(NTHREADS);
+        if (PREFETCH && NTHREADS > 1 && i+1 < ntarg && ! targ[i+1].self)
+          { if (MEM_LIMIT == 0 || reserve <= MEM_LIMIT/2)
+              { fetch.block    = (bblock == _bblock ? _bblock+1 : _bblock);
+                fetch.path     = targ[i+1].path;
+                fetch.root     = targ[i+1].root;
+                fetch.nthreads = FETCH_THREADS(NTHREADS);
+                fetch.verbose  = 0;
+                pthread_create(&fetcher,NULL,fetch_block,&fetch);
+                pending = 1;
+                Set_Filter_Threads(NTHREADS - fetch.nthreads);
+                if (MEM_LIMIT > 0)
+                  MEM_RESERVE = reserve;
+              }
+            else if (VERBOSE)
+              printf("\n   Not enough memory to fetch %s during comparison\n",targ[i+1].root);
+          }
+
+        if ( ! targ[i].self)
+          { merged = Match_Filter(aroot,ablock,broot,bblock,aindex,alen,bindex,blen,asettings);
+            Close_DB(bblock);
+          }
+        else
+          merged = Match_Filter(aroot,ablock,aroot,ablock,aindex,alen,aindex,alen,asettings);
 
 #define SYSTEM_CHECK(command)						\
  if (VERBOSE)								\
@@ -690,41 +942,43 @@ int main(int argc, char *argv[])
      Clean_Exit(1);							\
    }
 
-            command = CommandBuffer(aroot,broot,SORT_PATH);
+        command = CommandBuffer(aroot,broot,SORT_PATH);
 
-            sprintf(command,"LAsort %s %s %s/%s.%s.N%c",VERBOSE?"-v":"",
-                            MAP_ORDER?"-a":"",SORT_PATH,aroot,broot,BLOCK_SYMBOL);
+        if ((merged & MERGED_AB) == 0)
+          { sprintf(command,"LAsort %s %s %s/%s.%s.N%c",VERBOSE?"-v":"",
+                           MAP_ORDER?"-a":"",SORT_PATH,aroot,broot,BLOCK_SYMBOL);
             SYSTEM_CHECK(command)
 
             sprintf(command,"LAmerge %s %s %s.%s.las %s/%s.%s.N%c.S",VERBOSE?"-v":"",
-                            MAP_ORDER?"-a":"",aroot,broot,SORT_PATH,aroot,broot,BLOCK_SYMBOL);
+                           MAP_ORDER?"-a":"",aroot,broot,SORT_PATH,aroot,broot,BLOCK_SYMBOL);
             SYSTEM_CHECK(command)
+          }
 
-            if (strcmp(broot,aroot) != 0 || strcmp(bpath,apath) != 0)
-              { if (SYMMETRIC)
-                  { sprintf(command,"LAsort %s %s %s/%s.%s.N%c",VERBOSE?"-v":"",
-                                 MAP_ORDER?"-a":"",SORT_PATH,broot,aroot,BLOCK_SYMBOL);
-                    SYSTEM_CHECK(command)
+        if ( ! targ[i].self)
+          { if (SYMMETRIC && (merged & MERGED_BA) == 0)
+              { sprintf(command,"LAsort %s %s %s/%s.%s.N%c",VERBOSE?"-v":"",
+                             MAP_ORDER?"-a":"",SORT_PATH,broot,aroot,BLOCK_SYMBOL);
+                SYSTEM_CHECK(command)
 
-                    sprintf(command,"LAmerge %s %s %s.%s.las %s/%s.%s.N%c.S",VERBOSE?"-v":"",
-                                 MAP_ORDER?"-a":"",broot,aroot,SORT_PATH,broot,aroot,BLOCK_SYMBOL);
-                    SYSTEM_CHECK(command)
-                  }
+                sprintf(command,"LAmerge %s %s %s.%s.las %s/%s.%s.N%c.S",VERBOSE?"-v":"",
+                             MAP_ORDER?"-a":"",broot,aroot,SORT_PATH,broot,aroot,BLOCK_SYMBOL);
+                SYSTEM_CHECK(command)
               }
-
-            free(bpath);
-            free(broot);
           }
+      }
 
-        Free_Block_Arg(parse);
+    for (i = 0; i < ntarg; i++)
+      { free(targ[i].path);
+        free(targ[i].root);
       }
+    free(targ);
 
     for (j = 0; j < MTOP; j++)
       if (MSTAT[j] == 0)
         printf("%s: Warning: Track %s given but never used.\n", Prog_Name,MASK[j]);
   }
 
-  free(aindex);
+  Free_Kmers(aindex);
   Close_DB(ablock);
   free(apath);
   free(aroot);
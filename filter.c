@@ -15,6 +15,10 @@
 
 //  A complete threaded code for the filter
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     //  For O_DIRECT
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -22,6 +26,11 @@
 #include <unistd.h>
 #include <math.h>
 #include <pthread.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 
 #include "DB.h"
 #include "lsd.sort.h"
@@ -40,6 +49,18 @@
 
 #define DO_ALIGNMENT
 
+#define COMPACT_KMERS  //  Use 12 byte k-mer records for Kmer <= 16
+
+#define BUCKET_KMERS   //  Sort k-mers by a prefix scatter and in-cache bucket sorts (else LSD)
+
+#define AVX2_TUPLES    //  Use AVX2 k-mer extraction for unmasked blocks if the CPU has it
+
+#if defined(AVX2_TUPLES) && defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#else
+#undef AVX2_TUPLES
+#endif
+
 #undef  TEST_GATHER
 #undef  TEST_CONTAIN
 #undef  TEST_BRIDGE
@@ -66,6 +87,12 @@
 
 #define THREAD       pthread_t
 
+#if defined(__GNUC__)
+#define ALWAYS_INLINE  inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE  inline
+#endif
+
 #define MAX_CODE_16  0xffffu
 #define MAX_CODE_32  0xffffffffu
 #define MAX_CODE_64  0xffffffffffffffffllu
@@ -76,11 +103,20 @@
 
 #define MAXGRAM 10000  //  Cap on k-mer count histogram (in count_thread, merge_thread)
 
-#define PANEL_SIZE     50000   //  Size to break up very long A-reads
-#define PANEL_OVERLAP  10000   //  Overlap of A-panels
+#define PANEL_SIZE     50000   //  Least size of the panels very long A-reads are broken into,
+#define PANEL_COUNT        8   //    unless the longest A-read is more than PANEL_COUNT panels
+#define PANEL_OVERLAP      5   //  Panels overlap by 1/PANEL_OVERLAP of their size
 
 #define MATCH_CHUNK    100     //  Max initial number of hits between two reads
 #define TRACE_CHUNK  20000     //  Max initial trace points in hits between two reads
+#define REPORT_CHUNKS   64     //  # of pieces of report work per thread (claimed dynamically)
+#define GALLOP_LINEAR    8     //  # of single steps through B before galloping (merge_thread)
+#define SEED_CHUNK    1000     //  Initial # of seeds of a read pair
+#define CHAIN_DRIFT      8     //  A chain's diagonal may drift by 1/CHAIN_DRIFT of the A-distance
+#define CHAIN_LOOK      64     //  # of most recent chains a seed is tried against
+
+#define LAS_BUFFER  0x400000   //  Size of the output buffer of each .las file of a report thread
+#define DIRECT_ALIGN    4096   //  Alignment of buffer, offsets, and sizes for O_DIRECT writes
 
 typedef struct
   { uint32 rpos;
@@ -88,6 +124,23 @@ typedef struct
     uint64 code;
   } KmerPos;
 
+  //  For Kmer <= 16 the code fits in 32 bits and an index instead consists of the 12 byte
+  //    KmerPos32 records (if COMPACT_KMERS is defined).  The rpos and read fields are at the
+  //    same offsets in both, and the K* macros access the i'th record of a list of either kind
+  //    where c is Compact, or a constant in code specialized for one of the two layouts.
+
+typedef struct
+  { uint32 rpos;
+    uint32 read;
+    uint32 code;
+  } KmerPos32;
+
+#define KREC(l,i)     ((void *) (((char *) (l)) + ((int64) (i))*Ksize))
+#define KCODE(l,i,c)  ((c) ? (uint64) ((KmerPos32 *) (l))[i].code : ((KmerPos *) (l))[i].code)
+#define KREAD(l,i,c)  ((c) ? ((KmerPos32 *) (l))[i].read : ((KmerPos *) (l))[i].read)
+#define KRPOS(l,i,c)  ((c) ? ((KmerPos32 *) (l))[i].rpos : ((KmerPos *) (l))[i].rpos)
+#define KMAX(c)       ((c) ? (uint64) MAX_CODE_32 : MAX_CODE_64)
+
 typedef struct
   { int aread;
     int bread;
@@ -95,6 +148,57 @@ typedef struct
     int diag;
   } SeedPair;
 
+  //  Every k-mer index is preceded in memory by a Kmer_Header that records the parameters it
+  //    was built with, and is followed (at the next 8-byte boundary after its sentinels) by the
+  //    multiplicity histogram of the block's k-mers before any were suppressed, as hsize pairs
+  //    (multiplicity, # of distinct k-mers occurring that often) in increasing order.  If
+  //    CODE_COUNTS then the histogram is followed by a code table of the ncodes distinct codes
+  //    of the index in order (as uint32's if Compact, uint64's otherwise) and then the # of
+  //    times each occurs (as uint32's).  An index file is simply the header, index, histogram,
+  //    and code table, so that a file can be mapped and used in place.  msize is the size of
+  //    the mapping if the index is a mapped file, and 0 if the index was allocated.
+
+#define INDEX_MAGIC   "DAZKIDX"
+#define INDEX_VERSION 5
+
+typedef struct
+  { char   magic[8];    //  INDEX_MAGIC
+    int    version;     //  INDEX_VERSION
+    int    rsize;       //  Size of a record (Ksize) when built
+    int    kmer;        //  -k, -%, -W, -t, -b, and -R when built
+    int    modthr;
+    int    window;
+    int    suppress;
+    int    budget;
+    int    sample;
+    int    cutoff;      //  K-mers occurring >= cutoff times were suppressed, or sampled down to
+                        //    cutoff-1 occurrences if sample is set (INT32_MAX if none)
+    int    nreads;      //  # of reads and bases in the indexed block
+    int64  totlen;
+    uint64 stamp;       //  Caller supplied stamp of block files and masks (see Save_Kmers)
+    int64  kmers;       //  # of k-mers in the index (not counting the 2 sentinels)
+    int64  hsize;       //  # of pairs in the histogram
+    int64  ncodes;      //  # of codes in the code table (0 if there is none)
+    int64  msize;       //  Size of mapping if mapped, 0 otherwise
+  } Kmer_Header;
+
+#define KMER_HEADER(list)  (((Kmer_Header *) (list)) - 1)
+
+#define HIST_OFFSET(kmers)  ((Ksize*((kmers)+2) + 7) & ~0x7ll)
+#define KMER_HIST(list)     ((int64 *) (((char *) (list)) + HIST_OFFSET(KMER_HEADER(list)->kmers)))
+
+#define CSIZE(c)                 ((c) ? sizeof(uint32) : sizeof(uint64))
+#define CODE_OFFSET(kmers,hsize) (HIST_OFFSET(kmers) + 2*sizeof(int64)*(hsize))
+#define CODE_TABLE(list)         (((char *) (list)) + CODE_OFFSET(KMER_HEADER(list)->kmers,  \
+                                                                 KMER_HEADER(list)->hsize))
+#define CODE_COUNT(list)         ((uint32 *) (CODE_TABLE(list)                              \
+                                                + CSIZE(Compact)*KMER_HEADER(list)->ncodes))
+#define TCODE(t,i,c)             ((c) ? (uint64) ((uint32 *) (t))[i] : ((uint64 *) (t))[i])
+
+#define INDEX_SIZE(kmers,hsize,ncodes) \
+           (sizeof(Kmer_Header) + CODE_OFFSET(kmers,hsize) \
+                                + (CSIZE(Compact)+sizeof(uint32))*(ncodes))
+
 /*******************************************************************************************
  *
  *  PARAMETER SETUP
@@ -102,12 +206,15 @@ typedef struct
  ********************************************************************************************/
 
   //  K-mer selection strategy control:
-  //    Select modimizers mod MODULUS < ModThr (best)
+  //    Select modimizers mod MODULUS < ModThr (best), or if Window > 0 then the
+  //    (Window,Kmer)-minimizers of each read (see mini_thread)
 
 #define MODULUS  101
 
 static int    Kmer;
 static uint64 ModThr;
+static int    Window;
+static double TupleRate;      //  Expected # of tuples per base
 static int    Koff;           //  Kmer + 1;
 static int    Kshift;         //  2*Kmer
 static uint64 Kmask;          //  2^Kshift - 1
@@ -121,10 +228,32 @@ static int Hitmin;
 static int Binshift;
 static int Suppress;
 static int TooFrequent;       //  (Suppress != 0) ? Suppress : INT32_MAX
+static int HitBudget;         //  Suppress k-mers to keep self-comparison hits <= HitBudget million
 
 static int NTHREADS;          //  # of threads to use
 
-void Set_Filter_Params(int kmer, int mod, int binshift, int suppress, int hitmin, int nthread)
+static int Compact;           //  Index records are KmerPos32's (else KmerPos's)
+static int Ksize;             //  Size of an index record
+
+static inline void Set_Kmer(void *l, int64 i, uint64 code, uint32 read, uint32 rpos)
+{ if (Compact)
+    { KmerPos32 *e = ((KmerPos32 *) l) + i;
+
+      e->code = code;
+      e->read = read;
+      e->rpos = rpos;
+    }
+  else
+    { KmerPos *e = ((KmerPos *) l) + i;
+
+      e->code = code;
+      e->read = read;
+      e->rpos = rpos;
+    }
+}
+
+void Set_Filter_Params(int kmer, int mod, int window, int binshift, int suppress, int budget,
+                       int hitmin, int nthread)
 { if (kmer > 32)
     { fprintf(stderr,"%s: Kmer length must be <= 32\n",Prog_Name);
       exit (1);
@@ -133,8 +262,10 @@ void Set_Filter_Params(int kmer, int mod, int binshift, int suppress, int hitmin
   Kmer     = kmer;
   Koff     = kmer+1;
   ModThr   = mod;
+  Window   = window;
   Binshift = binshift;
   Suppress = suppress;
+  HitBudget = budget;
   Hitmin   = hitmin;
 
   Kmer    = kmer;
@@ -159,8 +290,31 @@ void Set_Filter_Params(int kmer, int mod, int binshift, int suppress, int hitmin
     TooFrequent = Suppress;
 
   NTHREADS = nthread;
+
+  if (Window > 0)
+    TupleRate = 4./(Window+1);
+  else
+    TupleRate = (2.*ModThr)/MODULUS;
+
+#ifdef COMPACT_KMERS
+  Compact = (Kmer <= 16);
+#else
+  Compact = 0;
+#endif
+  if (Compact)
+    Ksize = sizeof(KmerPos32);
+  else
+    Ksize = sizeof(KmerPos);
 }
 
+static int Allow_AVX2 = 1;   //  Sort_Kmers may use the AVX2 k-mer code (if AVX2_TUPLES)
+
+void Set_Filter_AVX2(int avx2)
+{ Allow_AVX2 = avx2; }
+
+void Set_Filter_Threads(int nthread)
+{ NTHREADS = nthread; }
+
 
 /*******************************************************************************************
  *
@@ -171,24 +325,622 @@ void Set_Filter_Params(int kmer, int mod, int binshift, int suppress, int hitmin
 static DAZZ_DB    *TA_block;
 static DAZZ_TRACK *TA_track;
 
-static KmerPos *FR_src;
-static KmerPos *FR_trg;
+static void   *FR_src;
+static void   *FR_trg;
+static uint32 *FR_count;
 
 static uint64 Cumber[4];   //  Cumber[i] = (3-i) << (Kshift-2)
 
 typedef struct
-  { int    beg;
-    int    end;
-    int    fill;
+  { int64    beg;      //  Range of reads (or of k-mers in compsize & compress_thread)
+    int64    end;
+    int64    fill;
+    void    *list;     //  tuple_thread: list to fill,
+    int64    size;     //    its size (in one-pass mode an estimate, grown as needed),
+    int      own;      //    and whether it was allocated privately (and so must be freed)
   } Tuple_Arg;
 
+  //  In one-pass mode each tuple_thread fills a segment of the final list sized according to
+  //    the expected density of tuples, checking its capacity once per read (or unmasked interval)
+  //    against the 2 tuples per base it can at most generate.  Should it overflow, the segment
+  //    moves to a private list that is grown as needed.  Afterwards the segments are packed in
+  //    place if none overflowed, otherwise they are copied to a new list.
+
+#define TUPLE_CHUNK  0x1000   //  Minimum growth of a one-pass tuple list
+
+static void *Grow_Tuples(Tuple_Arg *data, int64 fill, int64 need)
+{ void  *list;
+  int64  size;
+
+  size = 1.2*need + TUPLE_CHUNK;
+  if (data->own)
+    list = Realloc(data->list,Ksize*size,"Growing tuple list");
+  else
+    { list = Malloc(Ksize*size,"Allocating tuple list");
+      if (list != NULL)
+        memcpy(list,data->list,Ksize*fill);
+    }
+  if (list == NULL)
+    Clean_Exit(1);
+
+  data->list = list;
+  data->size = size;
+  data->own  = 1;
+  return (list);
+}
+
+  //  Expected # of tuples for the bases of reads [beg,end) plus a 10% margin
+
+static int64 Tuple_Estimate(int beg, int end)
+{ int64 bases = TA_block->reads[end].boff - TA_block->reads[beg].boff;
+
+  return ((int64) (1.1*TupleRate*bases) + TUPLE_CHUNK);
+}
+
+  //  Pack the tuples of seg[0..n-1] in order at the start of list if they are all still in
+  //    their place in list, returning the total, or return -1 if one overflowed
+
+static int64 Pack_Tuples(Tuple_Arg *seg, int n, void *list)
+{ int64 x;
+  int   j;
+
+  for (j = 0; j < n; j++)
+    if (seg[j].own)
+      return (-1);
+
+  x = 0;
+  for (j = 0; j < n; j++)
+    { if (seg[j].list != KREC(list,x))
+        memmove(KREC(list,x),seg[j].list,Ksize*seg[j].fill);
+      x += seg[j].fill;
+    }
+  return (x);
+}
+
+  //  Copy the tuples of seg[0..n-1] in order to list, freeing any private segments
+
+static void Copy_Tuples(Tuple_Arg *seg, int n, void *list)
+{ int64 x;
+  int   j;
+
+  x = 0;
+  for (j = 0; j < n; j++)
+    { memcpy(KREC(list,x),seg[j].list,Ksize*seg[j].fill);
+      x += seg[j].fill;
+      if (seg[j].own)
+        free(seg[j].list);
+    }
+}
+
+  //  AVX2 versions of the unmasked loops of mask_thread and tuple_thread.  The reads of a
+  //    thread are split into LANES ranges of about the same number of bases, and the ranges
+  //    are scanned in lock-step, one per 64-bit lane.  The 64-bit test x % MODULUS < ModThr
+  //    is done by folding x into a sum of its four 16-bit digits weighted by 2^16i % MODULUS,
+  //    which is < 2^25, and then dividing exactly by multiplying with floor(2^32/MODULUS)+1.
+  //    Each lane places its tuples consecutively in its own segment so that concatenating the
+  //    segments gives exactly the order of the scalar code.
+
+#ifdef AVX2_TUPLES
+
+#define LANES 4
+
+static int   Use_AVX2;      //  CPU supports AVX2
+static int  *TA_count;      //  TA_count[i] = # of tuples of read i (set by counting pass)
+
+static uint64 Mod_Fold[3];  //  2^16, 2^32, 2^48 % MODULUS
+static uint64 Mod_Magic;    //  floor(2^32/MODULUS) + 1
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_ult(__m256i a, __m256i b, __m256i sign)
+{ return (_mm256_cmpgt_epi64(_mm256_xor_si256(b,sign),_mm256_xor_si256(a,sign))); }
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_select(__m256i x, __m256i *fold, __m256i thr)
+{ __m256i low = _mm256_set1_epi64x(0xffff);
+  __m256i n, q;
+
+  n = _mm256_and_si256(x,low);
+  n = _mm256_add_epi64(n,_mm256_mul_epu32(_mm256_and_si256(_mm256_srli_epi64(x,16),low),fold[0]));
+  n = _mm256_add_epi64(n,_mm256_mul_epu32(_mm256_and_si256(_mm256_srli_epi64(x,32),low),fold[1]));
+  n = _mm256_add_epi64(n,_mm256_mul_epu32(_mm256_srli_epi64(x,48),fold[2]));
+  q = _mm256_srli_epi64(_mm256_mul_epu32(n,fold[3]),32);
+  n = _mm256_sub_epi64(n,_mm256_mul_epu32(q,fold[4]));
+  return (_mm256_cmpgt_epi64(thr,n));
+}
+
+  //  Lane j scans the reads [seg[j].beg,seg[j].end).  If seg[0].list == NULL the tuples of each
+  //    read are counted into TA_count and those of each lane into seg[j].fill, otherwise the
+  //    tuples are placed in seg[j].list starting at seg[j].fill, growing it if need be.
+
+__attribute__((target("avx2")))
+static void avx2_tuples(Tuple_Arg *seg)
+{ DAZZ_READ *reads = TA_block->reads;
+  char      *bases = (char *) (TA_block->bases);
+  int        km1   = Kmer-1;
+  int        count = (seg[0].list == NULL);
+
+  void     *list[LANES];    //  Segment of each lane
+  char     *ptr[LANES];     //  Next base of each lane's read
+  int64     inc[LANES];     //  1 if lane is busy, 0 if idle
+  int       rem[LANES];     //  # of bases left in lane's read
+  int       rid[LANES];     //  Lane's read, -1 if idle
+  int       pos[LANES];     //  Position of lane's next base
+  int64     out[LANES];     //  Next list index of lane
+  int64     first[LANES];   //  Lane's count at start of its read
+  uint32    lbit[LANES];
+  uint64    cv[LANES], uv[LANES];
+  int64     nv[LANES];
+  uint64    sel1[LANES], sel2[LANES];   //  Selected codes of last step
+
+  __m256i   vHF, vLF, vHR, vLR, vK, vsign, vthr, vthree, fold[5];
+  __m128i   cshift;
+  __m256i   c, u, d, v, n;
+  int       i, j, p, t, steps, busy;
+
+  vHF    = _mm256_set1_epi64x(HFmask);
+  vLF    = _mm256_set1_epi64x(LFmask);
+  vHR    = _mm256_set1_epi64x(HRmask);
+  vLR    = _mm256_set1_epi64x(LRmask);
+  vK     = _mm256_set1_epi64x(Kmask);
+  vsign  = _mm256_set1_epi64x(0x8000000000000000ll);
+  vthr   = _mm256_set1_epi64x(ModThr);
+  vthree = _mm256_set1_epi64x(3);
+  cshift = _mm_set_epi64x(0,Kshift-2);
+  fold[0] = _mm256_set1_epi64x(Mod_Fold[0]);
+  fold[1] = _mm256_set1_epi64x(Mod_Fold[1]);
+  fold[2] = _mm256_set1_epi64x(Mod_Fold[2]);
+  fold[3] = _mm256_set1_epi64x(Mod_Magic);
+  fold[4] = _mm256_set1_epi64x(MODULUS);
+
+  for (j = 0; j < LANES; j++)
+    { rid[j]  = -1;
+      rem[j]  = 0;
+      list[j] = seg[j].list;
+      out[j]  = seg[j].fill;
+      nv[j]   = 0;
+    }
+
+  while (1)
+
+    { //  Finish reads that are done and refill their lanes
+
+      busy = 0;
+      for (j = 0; j < LANES; j++)
+        { if (rem[j] > 0)
+            { busy += 1;
+              continue;
+            }
+          if (rid[j] >= 0 && count)
+            TA_count[rid[j]] = nv[j] - first[j];
+          rid[j] = -1;
+
+          while (seg[j].beg < seg[j].end && reads[seg[j].beg].rlen <= km1)
+            { if (count)
+                TA_count[seg[j].beg] = 0;
+              seg[j].beg += 1;
+            }
+          if (seg[j].beg >= seg[j].end)
+            { ptr[j] = bases;
+              inc[j] = 0;
+              cv[j]  = uv[j] = 0;
+              continue;
+            }
+
+          i = seg[j].beg++;
+          { char  *s = bases + reads[i].boff;
+            uint64 cc, uu;
+            int    x;
+
+            cc = uu = 0;
+            for (p = 0; p < km1; p++)
+              { x  = s[p];
+                cc = (cc << 2) | x;
+                uu = (uu >> 2) | Cumber[x];
+              }
+            cv[j]    = cc;
+            uv[j]    = uu;
+            ptr[j]   = s + km1;
+            inc[j]   = 1;
+            pos[j]   = km1;
+            rem[j]   = reads[i].rlen - km1;
+            rid[j]   = i;
+            lbit[j]  = 0;
+            first[j] = nv[j];
+            if ( ! count && out[j] + 2*rem[j] > seg[j].size)
+              list[j] = Grow_Tuples(seg+j,out[j],out[j]+2*rem[j]);
+          }
+          busy += 1;
+        }
+      if (busy == 0)
+        break;
+
+      steps = INT32_MAX;
+      for (j = 0; j < LANES; j++)
+        if (rid[j] >= 0 && rem[j] < steps)
+          steps = rem[j];
+
+      //  Scan all busy lanes steps bases forward
+
+      { __m256i act, s1, s2, m1, m2;
+
+        act = _mm256_set_epi64x(-inc[3],-inc[2],-inc[1],-inc[0]);
+        c   = _mm256_loadu_si256((__m256i *) cv);
+        u   = _mm256_loadu_si256((__m256i *) uv);
+        n   = _mm256_loadu_si256((__m256i *) nv);
+
+        for (t = 0; t < steps; t++)
+          { __m256i x = _mm256_set_epi64x(*ptr[3],*ptr[2],*ptr[1],*ptr[0]);
+
+            ptr[0] += inc[0];
+            ptr[1] += inc[1];
+            ptr[2] += inc[2];
+            ptr[3] += inc[3];
+
+            d = _mm256_and_si256(c,vHF);
+            c = _mm256_and_si256(_mm256_or_si256(_mm256_slli_epi64(c,2),x),vK);
+            d = _mm256_or_si256(d,_mm256_and_si256(c,vLF));
+
+            v = _mm256_and_si256(u,vLR);
+            u = _mm256_or_si256(_mm256_srli_epi64(u,2),
+                                _mm256_sll_epi64(_mm256_sub_epi64(vthree,x),cshift));
+            v = _mm256_or_si256(v,_mm256_and_si256(u,vHR));
+
+            m1 = avx2_ult(u,c,vsign);
+            s1 = _mm256_blendv_epi8(c,u,m1);
+            m2 = avx2_ult(v,d,vsign);
+            s2 = _mm256_blendv_epi8(d,v,m2);
+
+            s1 = _mm256_and_si256(avx2_select(s1,fold,vthr),act);
+            s2 = _mm256_and_si256(avx2_select(s2,fold,vthr),act);
+
+            if (count)
+              n = _mm256_sub_epi64(n,_mm256_add_epi64(s1,s2));
+
+            else
+              { int b1, b2, k1, k2;
+
+                b1 = _mm256_movemask_pd(_mm256_castsi256_pd(s1));
+                b2 = _mm256_movemask_pd(_mm256_castsi256_pd(s2));
+                if ((b1 | b2) != 0)
+                  { _mm256_storeu_si256((__m256i *) sel1,_mm256_blendv_epi8(c,u,m1));
+                    _mm256_storeu_si256((__m256i *) sel2,_mm256_blendv_epi8(d,v,m2));
+                    k1 = _mm256_movemask_pd(_mm256_castsi256_pd(m1));
+                    k2 = _mm256_movemask_pd(_mm256_castsi256_pd(m2));
+                    for (j = 0; j < LANES; j++)
+                      { uint32 r, q;
+
+                        if (((b1 | b2) & (1 << j)) == 0)   //  Idle lanes have rid[j] = -1
+                          continue;
+                        r = ((uint32) rid[j]) << 1;
+                        q = pos[j] + t + 1;
+
+                        if (b1 & (1 << j))
+                          Set_Kmer(list[j],out[j]++,sel1[j],r | ((k1 >> j) & SIGN_BIT),q);
+                        if (b2 & (1 << j))
+                          Set_Kmer(list[j],out[j]++,sel2[j],r | ((k2 >> j) & SIGN_BIT),
+                                   q | ((t > 0) ? LONG_BIT : lbit[j]));
+                      }
+                  }
+              }
+          }
+
+        _mm256_storeu_si256((__m256i *) cv,c);
+        _mm256_storeu_si256((__m256i *) uv,u);
+        _mm256_storeu_si256((__m256i *) nv,n);
+      }
+
+      for (j = 0; j < LANES; j++)
+        if (rid[j] >= 0)
+          { rem[j]  -= steps;
+            pos[j]  += steps;
+            lbit[j]  = LONG_BIT;
+          }
+    }
+
+  for (j = 0; j < LANES; j++)
+    if (count)
+      seg[j].fill = nv[j];
+    else
+      seg[j].fill = out[j];
+}
+
+  //  Split the reads of data into LANES ranges and scan them with avx2_tuples.  If count is
+  //    set, return the # of tuples.  Otherwise in one-pass mode the lanes fill segments of
+  //    data->list that are then packed, and in two-pass mode the segments start where the
+  //    counts in TA_count say they do.  Returns the # of tuples placed.
+
+static int64 avx2_thread(Tuple_Arg *data, int count)
+{ DAZZ_READ *reads = TA_block->reads;
+  Tuple_Arg  seg[LANES];
+  int64      b0, bn, x;
+  int        i, j;
+
+  b0 = reads[data->beg].boff;
+  bn = reads[data->end].boff;
+  i  = data->beg;
+  for (j = 0; j < LANES; j++)
+    { seg[j].beg = i;
+      x = b0 + ((bn-b0)*(j+1))/LANES;
+      while (i < data->end && reads[i].boff < x)
+        i += 1;
+      if (j == LANES-1)
+        i = data->end;
+      seg[j].end = i;
+      seg[j].own = 0;
+    }
+
+  if (count)
+    { for (j = 0; j < LANES; j++)
+        { seg[j].list = NULL;
+          seg[j].fill = 0;
+        }
+      avx2_tuples(seg);
+    }
+
+  else if (ONE_PASS)
+    { x = 0;
+      for (j = 0; j < LANES; j++)
+        { seg[j].list = KREC(data->list,x);
+          seg[j].fill = 0;
+          if (j == LANES-1)
+            seg[j].size = data->size - x;
+          else
+            seg[j].size = Tuple_Estimate(seg[j].beg,seg[j].end);
+          if (seg[j].size < 0)
+            seg[j].size = 0;
+          x += seg[j].size;
+        }
+      avx2_tuples(seg);
+
+      x = Pack_Tuples(seg,LANES,data->list);
+      if (x < 0)
+        { x = 0;
+          for (j = 0; j < LANES; j++)
+            x += seg[j].fill;
+          Grow_Tuples(data,0,x);
+          Copy_Tuples(seg,LANES,data->list);
+        }
+      return (x);
+    }
+
+  else
+    { x = data->fill;
+      for (j = 0; j < LANES; j++)
+        { seg[j].list = data->list;
+          seg[j].fill = x;
+          seg[j].size = INT64_MAX;
+          for (i = seg[j].beg; i < seg[j].end; i++)
+            x += TA_count[i];
+        }
+      avx2_tuples(seg);
+    }
+
+  x = 0;
+  for (j = 0; j < LANES; j++)
+    x += seg[j].fill;
+  return (x);
+}
+
+#endif
+
+  //  Windowed minimizer selection (-W).  Each unmasked interval of a read gives a stream of
+  //    contiguous and a stream of split k-mers, and a k-mer of a stream is selected if its
+  //    hash is the minimum of some Window consecutive k-mers of the stream (or of the whole
+  //    stream if it is shorter).  All k-mers tied for a minimum are selected so that a read
+  //    and its complement select the same k-mers.  Every Window consecutive k-mers thus have
+  //    a selected one, at a density of about 2/(Window+1) per stream versus ModThr/MODULUS
+  //    for modimizers.  The split k-mer at the start of an interval is not a real one and is
+  //    not in its stream.
+  //  A k-mer is a window minimum iff the run of k-mers about it with hashes no smaller than
+  //    its own is >= Window long.  The k-mers whose right end of this run is not yet known
+  //    are kept on a stack of non-decreasing hashes, so each k-mer is decided in amortized
+  //    constant time, when it is popped by a smaller hash or at the end of its stream.
+
+typedef struct
+  { uint64 hash;    //  Hash of code
+    uint64 code;    //  Canonical k-mer, and read and rpos fields for it as in a KmerPos
+    uint32 read;
+    uint32 rpos;
+    int    pos;     //  Index of k-mer in its stream
+    int    left;    //  Index of the leftmost k-mer of the run to its left with hash >= hash
+  } Mini_Entry;
+
+static inline uint64 mini_hash(uint64 x)
+{ x ^= (x >> 30);
+  x *= 0xbf58476d1ce4e5b9llu;
+  x ^= (x >> 27);
+  x *= 0x94d049bb133111ebllu;
+  x ^= (x >> 31);
+  return (x);
+}
+
+  //  Push the k-mer at index j of the stream on stk[0..*top-1], popping and emitting to list
+  //    (or just counting if list is NULL) the entries it terminates the run of
+
+static inline int64 mini_push(Mini_Entry *stk, int *top, int j, uint64 code, uint32 read,
+                              uint32 rpos, void *list, int64 idx)
+{ Mini_Entry *e;
+  uint64      h;
+  int         t;
+
+  h = mini_hash(code);
+  t = *top;
+  while (t > 0 && stk[t-1].hash > h)
+    { e = stk + (--t);
+      if (j - e->left >= Window)
+        { if (list != NULL)
+            Set_Kmer(list,idx,e->code,e->read,e->rpos);
+          idx += 1;
+        }
+    }
+
+  e = stk + t;
+  if (t == 0)
+    e->left = 0;
+  else if (stk[t-1].hash < h)
+    e->left = stk[t-1].pos + 1;
+  else
+    e->left = stk[t-1].left;
+  e->hash = h;
+  e->code = code;
+  e->read = read;
+  e->rpos = rpos;
+  e->pos  = j;
+  *top = t+1;
+  return (idx);
+}
+
+  //  Emit the entries of stk[0..top-1] that are minima of a stream of n k-mers
+
+static inline int64 mini_flush(Mini_Entry *stk, int top, int n, void *list, int64 idx)
+{ int w, t;
+
+  if (n < Window)
+    w = n;
+  else
+    w = Window;
+  for (t = 0; t < top; t++)
+    if (n - stk[t].left >= w)
+      { if (list != NULL)
+          Set_Kmer(list,idx,stk[t].code,stk[t].read,stk[t].rpos);
+        idx += 1;
+      }
+  return (idx);
+}
+
+  //  Select the minimizers of the interval [p,q) of read r whose bases start at s
+
+static int64 mini_interval(char *s, int p, int q, uint32 r, Mini_Entry *cstk,
+                           Mini_Entry *dstk, void *list, int64 idx)
+{ int    km1 = Kmer-1;
+  int    x, j, ct, dt;
+  uint64 c, u;
+  uint64 d, v;
+
+  c = 0;
+  u = 0;
+  for (x = 0; x < km1; x++)
+    { c = ((c << 2) | s[p]);
+      u = (u >> 2) | Cumber[(int) s[p]];
+      p += 1;
+    }
+
+  ct = dt = 0;
+  for (j = 0; p < q; j++)
+    { x = s[p++];
+
+      d = (c & HFmask);
+      c = ((c << 2) | x) & Kmask;
+      d = d | (c & LFmask);
+
+      v = (u & LRmask);
+      u = (u >> 2) | Cumber[x];
+      v = v | (u & HRmask);
+
+      if (u < c)
+        idx = mini_push(cstk,&ct,j,u,r | SIGN_BIT,p,list,idx);
+      else
+        idx = mini_push(cstk,&ct,j,c,r,p,list,idx);
+
+      if (j > 0)
+        { if (v < d)
+            idx = mini_push(dstk,&dt,j-1,v,r | SIGN_BIT,p | LONG_BIT,list,idx);
+          else
+            idx = mini_push(dstk,&dt,j-1,d,r,p | LONG_BIT,list,idx);
+        }
+    }
+
+  idx = mini_flush(cstk,ct,j,list,idx);
+  idx = mini_flush(dstk,dt,j-1,list,idx);
+  return (idx);
+}
+
+  //  Minimizer versions of mask_thread (count = 1) and tuple_thread (count = 0), returning
+  //    the # of tuples counted or the fill index of the list
+
+static int64 mini_thread(Tuple_Arg *data, int count)
+{ DAZZ_READ  *reads = TA_block->reads;
+  int         km1   = Kmer-1;
+  Mini_Entry *cstk, *dstk;
+  void       *list;
+  int         beg, end;
+  int64       idx;
+  int64       a, b, f;
+  int         i, p, q, maxlen;
+  char       *s;
+
+  beg = data->beg;
+  end = data->end;
+
+  maxlen = 1;
+  for (i = beg; i < end; i++)
+    if (reads[i].rlen > maxlen)
+      maxlen = reads[i].rlen;
+  cstk = (Mini_Entry *) Malloc(2*sizeof(Mini_Entry)*maxlen,"Allocating minimizer stacks");
+  if (cstk == NULL)
+    Clean_Exit(1);
+  dstk = cstk + maxlen;
+
+  if (count)
+    { list = NULL;
+      idx  = 0;
+    }
+  else
+    { list = data->list;
+      idx  = data->fill;
+    }
+
+  s = ((char *) (TA_block->bases)) + reads[beg].boff;
+  if (TA_track != NULL)
+    { int64 *anno1 = ((int64 *) (TA_track->anno)) + 1;
+      int   *point = (int *) (TA_track->data);
+
+      q = 0;
+      f = anno1[beg-1];
+      for (i = beg; i < end; i++)
+        { b = f;
+          f = anno1[i];
+          for (a = b; a <= f; a += 2)
+            { if (a == b)
+                p = 0;
+              else
+                p = point[a-1];
+              if (a == f)
+                q = reads[i].rlen;
+              else
+                q = point[a];
+              if (q-p > km1)
+                { if (list != NULL && idx + 2*(q-p) > data->size)
+                    list = Grow_Tuples(data,idx,idx+2*(q-p));
+                  idx = mini_interval(s,p,q,i<<1,cstk,dstk,list,idx);
+                }
+            }
+          s += (q+1);
+        }
+    }
+  else
+    for (i = beg; i < end; i++)
+      { q = reads[i].rlen;
+        if (q > km1)
+          { if (list != NULL && idx + 2*q > data->size)
+              list = Grow_Tuples(data,idx,idx+2*q);
+            idx = mini_interval(s,0,q,i<<1,cstk,dstk,list,idx);
+          }
+        s += (q+1);
+      }
+
+  free(cstk);
+  return (idx);
+}
+
   //  for reads [beg,end) computing how many k-tuples are not masked
 
 static void *mask_thread(void *arg)
 { Tuple_Arg *data  = (Tuple_Arg *) arg;
   DAZZ_READ *reads = TA_block->reads;
   int        km1   = Kmer-1;
-  int        beg, end, idx;
+  int        beg, end;
+  int64      idx;
   int64      a, b, f;
   int        i, p, q;
 
@@ -202,7 +954,9 @@ static void *mask_thread(void *arg)
   idx = 0;
 
   s = ((char *) (TA_block->bases)) + TA_block->reads[beg].boff;
-  if (TA_track != NULL)
+  if (Window > 0)
+    idx = mini_thread(data,1);
+  else if (TA_track != NULL)
     { int64 *anno1 = ((int64 *) (TA_track->anno)) + 1;
       int   *point = (int *) (TA_track->data);
 
@@ -261,6 +1015,10 @@ static void *mask_thread(void *arg)
           s += (q+1);
         }
     }
+#ifdef AVX2_TUPLES
+  else if (Use_AVX2)
+    idx = avx2_thread(data,1);
+#endif
   else
     for (i = beg; i < end; i++)
       { q = reads[i].rlen;
@@ -312,8 +1070,9 @@ static void *tuple_thread(void *arg)
 { Tuple_Arg *data  = (Tuple_Arg *) arg;
   DAZZ_READ *reads = TA_block->reads;
   int        km1   = Kmer-1;
-  KmerPos   *list  = FR_src;
-  int        beg, end, idx;
+  void      *list  = data->list;
+  int        beg, end;
+  int64      idx;
   int64     a, b, f;
   int       i, p, q, x, r;
   uint64    c, u;
@@ -326,7 +1085,9 @@ static void *tuple_thread(void *arg)
   idx = data->fill;
 
   s = ((char *) (TA_block->bases)) + TA_block->reads[beg].boff;
-  if (TA_track != NULL)
+  if (Window > 0)
+    idx = mini_thread(data,0);
+  else if (TA_track != NULL)
     { int64     *anno1 = ((int64 *) (TA_track->anno)) + 1;
       int       *point = (int *) (TA_track->data);
 
@@ -346,7 +1107,9 @@ static void *tuple_thread(void *arg)
               else
                 q = point[a];
               if (q-p > km1)
-                { c = 0;
+                { if (idx + 2*(q-p) > data->size)
+                    list = Grow_Tuples(data,idx,idx+2*(q-p));
+                  c = 0;
                   u = 0;
                   for (x = 1; x < Kmer; x++)
                     { c = ((c << 2) | s[p]);
@@ -368,34 +1131,26 @@ static void *tuple_thread(void *arg)
 
                       if (u < c)
                         { if (u % MODULUS < ModThr)
-                            { list[idx].code = u;
-                              list[idx].read = r | SIGN_BIT;
-                              list[idx].rpos = p;
-		              idx += 1;
+                            { Set_Kmer(list,idx,u,r | SIGN_BIT,p);
+                              idx += 1;
                             }
                         }
                       else
                         { if (c % MODULUS < ModThr)
-                            { list[idx].code = c;
-                              list[idx].read = r;
-                              list[idx].rpos = p;
-		              idx += 1;
+                            { Set_Kmer(list,idx,c,r,p);
+                              idx += 1;
                             }
                         }
 
                       if (v < d)
                         { if (v % MODULUS < ModThr)
-                            { list[idx].code = v;
-                              list[idx].read = r | SIGN_BIT;
-                              list[idx].rpos = p | lbit;
+                            { Set_Kmer(list,idx,v,r | SIGN_BIT,p | lbit);
                               idx += 1;
                             }
                         }
                       else
                         { if (d % MODULUS < ModThr)
-                            { list[idx].code = d;
-                              list[idx].read = r;
-                              list[idx].rpos = p | lbit;
+                            { Set_Kmer(list,idx,d,r,p | lbit);
                               idx += 1;
                             }
                         }
@@ -407,10 +1162,16 @@ static void *tuple_thread(void *arg)
         }
     }
 
+#ifdef AVX2_TUPLES
+  else if (Use_AVX2)
+    idx = avx2_thread(data,0);
+#endif
   else
     for (i = beg; i < end; i++)
       { q = reads[i].rlen;
         r = (i << 1);
+        if (idx + 2*q > data->size)
+          list = Grow_Tuples(data,idx,idx+2*q);
         c = 0;
         u = 0;
         for (p = 0; p < km1; p++)
@@ -432,34 +1193,26 @@ static void *tuple_thread(void *arg)
 
             if (u < c)
               { if (u % MODULUS < ModThr)
-                  { list[idx].code = u;
-                    list[idx].read = r | SIGN_BIT;
-                    list[idx].rpos = p;
-	            idx += 1;
+                  { Set_Kmer(list,idx,u,r | SIGN_BIT,p);
+                    idx += 1;
                   }
               }
             else
               { if (c % MODULUS < ModThr)
-                  { list[idx].code = c;
-                    list[idx].read = r;
-                    list[idx].rpos = p;
-	            idx += 1;
+                  { Set_Kmer(list,idx,c,r,p);
+                    idx += 1;
                   }
               }
 
             if (v < d)
               { if (v % MODULUS < ModThr)
-                  { list[idx].code = v;
-                    list[idx].read = r | SIGN_BIT;
-                    list[idx].rpos = p | lbit;
+                  { Set_Kmer(list,idx,v,r | SIGN_BIT,p | lbit);
                     idx += 1;
                   }
               }
             else
               { if (d % MODULUS < ModThr)
-                  { list[idx].code = d;
-                    list[idx].read = r;
-                    list[idx].rpos = p | lbit;
+                  { Set_Kmer(list,idx,d,r,p | lbit);
                     idx += 1;
                   }
               }
@@ -468,155 +1221,750 @@ static void *tuple_thread(void *arg)
         s += (q+1);
       }
 
+  if (ONE_PASS || Window > 0)
+    data->fill = idx;
   return (NULL);
 }
 
+  //  compsize_thread histograms the multiplicities of the codes of its segment of the sorted
+  //    list, from which the suppression cutoff and the size of each thread's part of the
+  //    compressed list are then determined
+
+#define HIST_DENSE  0x1000   //  Multiplicities at least this large are listed individually
+
+typedef struct
+  { int64  beg;      //  Segment [beg,end) of the sorted list (starts at a new code)
+    int64  end;
+    int64 *hist;     //  hist[m] = # of codes occurring m < HIST_DENSE times
+    int64 *big;      //  big[0..nbig-1] = multiplicities >= HIST_DENSE
+    int64  nbig;
+    int64  mbig;
+  } Hist_Arg;
+
+static int64 Cutoff;   //  Codes occurring >= Cutoff times are suppressed
+
 static void *compsize_thread(void *arg)
-{ Tuple_Arg  *data  = (Tuple_Arg *) arg;
-  int         end   = data->end;
-  KmerPos    *src   = FR_src;
-  int         n, i, c, p;
+{ Hist_Arg   *data  = (Hist_Arg *) arg;
+  int64       end   = data->end;
+  int64      *hist  = data->hist;
+  void       *src   = FR_src;
+  int64       i, c, p;
   uint64      h, g;
 
+  for (c = 0; c < HIST_DENSE; c++)
+    hist[c] = 0;
+  data->nbig = 0;
+
   i = data->beg;
-  h = src[i].code;
-  n = 0;
+  h = KCODE(src,i,Compact);
   while (i < end)
     { p = i++;
       while (1)
-        { g = src[i].code; 
+        { g = KCODE(src,i,Compact);
           if (g != h)
             break;
           i += 1;
         }
-      if ((c = (i-p)) < TooFrequent)
-        n += c;
+      if ((c = (i-p)) < HIST_DENSE)
+        hist[c] += 1;
+      else
+        { if (data->nbig >= data->mbig)
+            { data->mbig = 1.2*data->nbig + 100;
+              data->big  = (int64 *) Realloc(data->big,sizeof(int64)*data->mbig,
+                                             "Growing multiplicity list");
+              if (data->big == NULL)
+                Clean_Exit(1);
+            }
+          data->big[data->nbig++] = c;
+        }
       h = g;
     }
 
-  data->fill = n;
   return (NULL);
 }
 
-static void *compress_thread(void *arg)
-{ Tuple_Arg  *data  = (Tuple_Arg *) arg;
-  int         end   = data->end;
-  KmerPos    *src   = FR_src;
-  KmerPos    *trg   = FR_trg;
-  int         n, i, p;
-  uint64      h, g;
+  //  # of k-mers of a compsize_thread segment that are kept, i.e. all the occurrences of
+  //    codes occurring less than Cutoff times and, if SUBSAMPLE, Cutoff-1 occurrences of
+  //    every other code
 
-  i = data->beg;
-  h = src[i].code;
-  n = data->fill;
-  while (i < end)
-    { p = i++;
-      while (1)
-        { g = src[i].code; 
-          if (g != h)
-            break;
-          i += 1;
-        }
-      if (i-p < TooFrequent)
-        { while (p < i)
-            trg[n++] = src[p++];
-        }
-      h = g;
-    }
+static int64 Kept_Kmers(Hist_Arg *data)
+{ int64 n, m, j, o;
 
-  return (NULL);
+  n = 0;
+  o = 0;
+  for (m = 1; m < HIST_DENSE; m++)
+    if (m < Cutoff)
+      n += m * data->hist[m];
+    else
+      o += data->hist[m];
+  for (j = 0; j < data->nbig; j++)
+    if (data->big[j] < Cutoff)
+      n += data->big[j];
+    else
+      o += 1;
+  if (SUBSAMPLE)
+    n += o * (Cutoff-1);
+  return (n);
 }
 
-void *Sort_Kmers(DAZZ_DB *block, int *len)
-{ THREAD    threads[NTHREADS];
-  Tuple_Arg parmt[NTHREADS];
+  //  # of distinct codes of a compsize_thread segment that are kept
 
-  KmerPos  *src, *trg, *rez;
-  int       kmers, nreads;
+static int64 Kept_Codes(Hist_Arg *data)
+{ int64 n, m, j;
+  int   all;
 
-  nreads = block->nreads;
+  all = (SUBSAMPLE && Cutoff > 1);
+  n = 0;
+  for (m = 1; m < HIST_DENSE; m++)
+    if (m < Cutoff || all)
+      n += data->hist[m];
+  for (j = 0; j < data->nbig; j++)
+    if (data->big[j] < Cutoff || all)
+      n += 1;
+  return (n);
+}
 
-  if (block->reads[nreads].boff > 0x7fffffffll)
-    { fprintf(stderr,"%s: Fatal error, DB blocks are greater than 2Gbp!\n",Prog_Name);
-      Clean_Exit(1);
-    }
+static int int64_cmp(const void *l, const void *r)
+{ int64 x = *((int64 *) l);
+  int64 y = *((int64 *) r);
 
-  if (nreads <= 0)
-    goto no_mers;
+  return ((x > y) - (x < y));
+}
 
-  TA_block = block;
-  TA_track = block->tracks;
+  //  Merge the histograms of parm[0..n-1] into a list of *hsize (multiplicity, # of codes)
+  //    pairs in increasing order of multiplicity
+
+static int64 *Merge_Hist(Hist_Arg *parm, int n, int64 *hsize)
+{ int64 *hist, *big;
+  int64  nbig, m, j, k;
+  int    i;
+
+  nbig = 0;
+  for (i = 0; i < n; i++)
+    nbig += parm[i].nbig;
+
+  hist = (int64 *) Malloc(2*sizeof(int64)*(HIST_DENSE+nbig),"Allocating histogram");
+  big  = (int64 *) Malloc(sizeof(int64)*(nbig+1),"Allocating histogram");
+  if (hist == NULL || big == NULL)
+    Clean_Exit(1);
+
+  k = 0;
+  for (m = 1; m < HIST_DENSE; m++)
+    { hist[2*k+1] = 0;
+      for (i = 0; i < n; i++)
+        hist[2*k+1] += parm[i].hist[m];
+      if (hist[2*k+1] > 0)
+        hist[2*(k++)] = m;
+    }
+
+  nbig = 0;
+  for (i = 0; i < n; i++)
+    for (j = 0; j < parm[i].nbig; j++)
+      big[nbig++] = parm[i].big[j];
+  qsort(big,nbig,sizeof(int64),int64_cmp);
+
+  for (j = 0; j < nbig; j++)
+    if (k > 0 && hist[2*(k-1)] == big[j])
+      hist[2*k-1] += 1;
+    else
+      { hist[2*k]   = big[j];
+        hist[2*k+1] = 1;
+        k += 1;
+      }
+
+  free(big);
+  *hsize = k;
+  return (hist);
+}
+
+  //  The cutoff t that keeps the self-comparison hits of a block with histogram hist within
+  //    HitBudget million.  These hits are bounded by the sum over kept codes of m^2 for a code
+  //    occurring m times (where m = t-1 for a code sampled down to t-1 occurrences), and by
+  //    Cauchy-Schwarz the hits between two blocks so limited are also within the budget.
+  //    At least the unique codes are always kept.
+
+static int64 Budget_Cutoff(int64 *hist, int64 hsize)
+{ double e, r, budget;
+  int64  j, m, t;
+
+  budget = HitBudget * 1.e6;
+  r = 0.;
+  for (j = 0; j < hsize; j++)
+    r += hist[2*j+1];
+  e = 0.;
+  for (j = 0; j < hsize; j++)
+    { m = hist[2*j];
+      if (SUBSAMPLE)                       //  Largest t <= m with e + (t-1)^2 r <= budget
+        { t = ((int64) sqrt((budget-e)/r)) + 1;
+          if (t <= m)
+            return (t > 2 ? t : 2);
+        }
+      e += ((double) m) * m * hist[2*j+1];
+      r -= hist[2*j+1];
+      if (e > budget)
+        return (m > 2 ? m : 2);
+    }
+  return (INT32_MAX);
+}
+
+  //  Print the histogram in bins of powers of 2
+
+static void Print_Hist(int64 *hist, int64 hsize)
+{ int64 lo, hi, codes, kmers, total;
+  int64 j;
+  char  range[50];
+
+  total = 0;
+  for (j = 0; j < hsize; j++)
+    total += hist[2*j] * hist[2*j+1];
+
+  printf("   K-mer multiplicity histogram:\n");
+  printf("           Times        Codes        K-mers   Cum. %%\n");
+  j = 0;
+  kmers = 0;
+  for (lo = 1; j < hsize; lo = hi+1)
+    { hi = 2*lo-1;
+      codes = 0;
+      while (j < hsize && hist[2*j] <= hi)
+        { codes += hist[2*j+1];
+          kmers += hist[2*j] * hist[2*j+1];
+          j += 1;
+        }
+      if (codes == 0)
+        continue;
+      if (lo == hi)
+        sprintf(range,"%lld",lo);
+      else
+        sprintf(range,"%lld-%lld",lo,hi);
+      printf("   %13s ",range);
+      Print_Number(codes,12,stdout);
+      printf("  ");
+      Print_Number(kmers,12,stdout);
+      printf("   %5.1f\n",(100.*kmers)/total);
+    }
+}
+
+  //  compress_thread copies the k-mers of its segment that are kept.  If SUBSAMPLE then of
+  //    the c >= Cutoff occurrences of a code (in order of read) the s = Cutoff-1 occurrences
+  //    p + (j*c + o)/s for j in [0,s) are kept, evenly spread over the reads containing it
+  //    with a phase o < s that varies with the code, so that different k-mers of a repeat
+  //    keep different reads.
+
+static void *compress_thread(void *arg)
+{ Tuple_Arg  *data  = (Tuple_Arg *) arg;
+  int64       end   = data->end;
+  void       *src   = FR_src;
+  void       *trg   = FR_trg;
+  int64       s     = Cutoff-1;
+  int64       n, i, p, c, o, j;
+  uint64      h, g;
+
+  i = data->beg;
+  h = KCODE(src,i,Compact);
+  n = data->fill;
+  while (i < end)
+    { p = i++;
+      while (1)
+        { g = KCODE(src,i,Compact);
+          if (g != h)
+            break;
+          i += 1;
+        }
+      c = i-p;
+      if (c < Cutoff)
+        { memcpy(KREC(trg,n),KREC(src,p),Ksize*c);
+          n += c;
+        }
+      else if (SUBSAMPLE && s > 0)
+        { o = mini_hash(h) % s;
+          for (j = 0; j < s; j++)
+            { memcpy(KREC(trg,n),KREC(src,p + (j*c + o)/s),Ksize);
+              n += 1;
+            }
+        }
+      h = g;
+    }
+
+  return (NULL);
+}
+
+  //  tally_thread lists the distinct codes of its segment [beg,end) of the final index in the
+  //    code table FR_trg, and the # of times each occurs in FR_count, starting at entry fill
+
+static void *tally_thread(void *arg)
+{ Tuple_Arg  *data  = (Tuple_Arg *) arg;
+  int64       end   = data->end;
+  void       *src   = FR_src;
+  void       *code  = FR_trg;
+  uint32     *count = FR_count;
+  int64       n, i, p;
+  uint64      h;
+
+  i = data->beg;
+  n = data->fill;
+  while (i < end)
+    { p = i;
+      h = KCODE(src,i,Compact);
+      while (++i < end && KCODE(src,i,Compact) == h)
+        ;
+      if (Compact)
+        ((uint32 *) code)[n] = (uint32) h;
+      else
+        ((uint64 *) code)[n] = h;
+      count[n++] = (uint32) (i-p);
+    }
+
+  return (NULL);
+}
+
+#ifdef BUCKET_KMERS
+
+  //  Bucketed sort of a k-mer list by code.  The list is scattered on the top 2m bits of the
+  //    code into 4^m buckets, each thread moving its segment of the list to its own region of
+  //    each bucket, and then each bucket is radix sorted on the remaining bits while it is in
+  //    cache.  m is chosen so that buckets average about BUCKET_TARGET k-mers.  Both steps are
+  //    stable so the result is exactly that of LSD_Sort on the code bytes.
+
+#define BUCKET_TARGET  0x2000   //  Desired average # of k-mers in a bucket
+#define BUCKET_SMALL   16       //  Insertion sort buckets this small
+#define DIGIT_MAXBITS  11       //  In-bucket radix passes sort at most this many bits
+
+static void  *BK_src;           //  List to sort, and the other array
+static void  *BK_trg;
+static int    BK_shift;         //  Bucket of code c is c >> BK_shift
+static int    BK_nbuck;         //  # of buckets
+static int64 *BK_start;         //  Bucket b is [BK_start[b],BK_start[b+1]) in BK_trg
+static int    BK_digit;         //  In-bucket sorts take BK_passes passes of BK_digit bits
+static int    BK_passes;
+
+typedef struct
+  { int64  beg;      //  Segment [beg,end) of the list (bucket range in bucket_thread)
+    int64  end;
+    int64 *count;    //  # of k-mers of segment in each bucket, then where the next goes
+  } Bucket_Arg;
+
+static ALWAYS_INLINE void bcount_kmers(Bucket_Arg *data, const int cp)
+{ void  *src   = BK_src;
+  int64 *count = data->count;
+  int    shift = BK_shift;
+  int64  i;
+
+  for (i = 0; i < BK_nbuck; i++)
+    count[i] = 0;
+  for (i = data->beg; i < data->end; i++)
+    count[KCODE(src,i,cp) >> shift] += 1;
+}
+
+static void *bcount_thread(void *arg)
+{ if (Compact)
+    bcount_kmers((Bucket_Arg *) arg,1);
+  else
+    bcount_kmers((Bucket_Arg *) arg,0);
+  return (NULL);
+}
+
+static ALWAYS_INLINE void scatter_kmers(Bucket_Arg *data, const int cp)
+{ const int rsize = (cp ? sizeof(KmerPos32) : sizeof(KmerPos));
+  char     *src   = (char *) BK_src;
+  char     *trg   = (char *) BK_trg;
+  int64    *count = data->count;
+  int       shift = BK_shift;
+  int64     i;
+
+  for (i = data->beg; i < data->end; i++)
+    memcpy(trg + rsize*(count[KCODE(src,i,cp) >> shift]++), src + rsize*i, rsize);
+}
+
+static void *scatter_thread(void *arg)
+{ if (Compact)
+    scatter_kmers((Bucket_Arg *) arg,1);
+  else
+    scatter_kmers((Bucket_Arg *) arg,0);
+  return (NULL);
+}
+
+  //  Sort the buckets [data->beg,data->end) that are in BK_trg on the bits below BK_shift.
+  //    Every bucket takes BK_passes passes between BK_trg and BK_src and so ends up in
+  //    BK_trg if BK_passes is even and in BK_src otherwise.
+
+static ALWAYS_INLINE void bsort_kmers(Bucket_Arg *data, const int cp)
+{ const int rsize = (cp ? sizeof(KmerPos32) : sizeof(KmerPos));
+  int64    *count = data->count;
+  uint64    dmask = (0x1llu << BK_digit) - 1;
+  char     *a, *b, *x;
+  char      rec[sizeof(KmerPos)];
+  int64     beg, end, i, j, t, n;
+  uint64    c;
+  int       k, p, shift;
+
+  for (k = data->beg; k < data->end; k++)
+    { beg = BK_start[k];
+      end = BK_start[k+1];
+      a = (char *) BK_trg;
+      b = (char *) BK_src;
+
+      if (end-beg <= BUCKET_SMALL)
+        { for (i = beg+1; i < end; i++)
+            { c = KCODE(a,i,cp);
+              memcpy(rec,a + rsize*i,rsize);
+              for (j = i; j > beg && KCODE(a,j-1,cp) > c; j--)
+                memcpy(a + rsize*j,a + rsize*(j-1),rsize);
+              memcpy(a + rsize*j,rec,rsize);
+            }
+          if (BK_passes & 0x1)
+            memcpy(b + rsize*beg,a + rsize*beg,rsize*(end-beg));
+          continue;
+        }
+
+      for (p = 0; p < BK_passes; p++)
+        { shift = p*BK_digit;
+          for (t = 0; t <= (int64) dmask; t++)
+            count[t] = 0;
+          for (i = beg; i < end; i++)
+            count[(KCODE(a,i,cp) >> shift) & dmask] += 1;
+          n = beg;
+          for (t = 0; t <= (int64) dmask; t++)
+            { j = count[t];
+              count[t] = n;
+              n += j;
+            }
+          for (i = beg; i < end; i++)
+            memcpy(b + rsize*(count[(KCODE(a,i,cp) >> shift) & dmask]++),a + rsize*i,rsize);
+          x = a;
+          a = b;
+          b = x;
+        }
+    }
+}
+
+static void *bsort_thread(void *arg)
+{ if (Compact)
+    bsort_kmers((Bucket_Arg *) arg,1);
+  else
+    bsort_kmers((Bucket_Arg *) arg,0);
+  return (NULL);
+}
+
+  //  Sort the kmers k-mers of src using trg as the secondary array and return the one that
+  //    holds the result
+
+static void *Bucket_Sort(int64 kmers, void *src, void *trg, int nthreads)
+{ THREAD     threads[nthreads];
+  Bucket_Arg parmb[nthreads];
+  int64     *counts;
+  int64      x, y;
+  int        i, b, m, bits;
+
+  m = 1;
+  while (m < 8 && m < Kmer-1 && (kmers >> (2*m)) > BUCKET_TARGET)
+    m += 1;
+  BK_nbuck = (1 << (2*m));
+  BK_shift = Kshift - 2*m;
+
+  BK_passes = (BK_shift-1)/DIGIT_MAXBITS + 1;
+  BK_digit  = (BK_shift-1)/BK_passes + 1;
+
+  bits = BK_digit;
+  if (bits < 2*m)
+    bits = 2*m;
+  counts = (int64 *) Malloc(sizeof(int64)*nthreads*((1 << bits) + 1),"Allocating bucket counts");
+  BK_start = (int64 *) Malloc(sizeof(int64)*(BK_nbuck+1),"Allocating bucket starts");
+  if (counts == NULL || BK_start == NULL)
+    Clean_Exit(1);
+
+  BK_src = src;
+  BK_trg = trg;
+
+  //  Count each thread's segment into buckets, and then turn the counts into the place
+  //    each thread's next k-mer of each bucket goes
+
+  for (i = 0; i < nthreads; i++)
+    { parmb[i].beg   = (i*kmers) / nthreads;
+      parmb[i].end   = ((i+1)*kmers) / nthreads;
+      parmb[i].count = counts + i*((1 << bits) + 1);
+    }
+
+  for (i = 0; i < nthreads; i++)
+    pthread_create(threads+i,NULL,bcount_thread,parmb+i);
+  for (i = 0; i < nthreads; i++)
+    pthread_join(threads[i],NULL);
+
+  x = 0;
+  for (b = 0; b < BK_nbuck; b++)
+    { BK_start[b] = x;
+      for (i = 0; i < nthreads; i++)
+        { y = parmb[i].count[b];
+          parmb[i].count[b] = x;
+          x += y;
+        }
+    }
+  BK_start[BK_nbuck] = x;
+
+  for (i = 0; i < nthreads; i++)
+    pthread_create(threads+i,NULL,scatter_thread,parmb+i);
+  for (i = 0; i < nthreads; i++)
+    pthread_join(threads[i],NULL);
+
+  //  Give each thread a range of buckets with about the same # of k-mers and sort them
+
+  b = 0;
+  for (i = 0; i < nthreads; i++)
+    { parmb[i].beg = b;
+      x = ((i+1)*kmers) / nthreads;
+      while (b < BK_nbuck && BK_start[b] < x)
+        b += 1;
+      if (i == nthreads-1)
+        b = BK_nbuck;
+      parmb[i].end = b;
+    }
+
+  for (i = 0; i < nthreads; i++)
+    pthread_create(threads+i,NULL,bsort_thread,parmb+i);
+  for (i = 0; i < nthreads; i++)
+    pthread_join(threads[i],NULL);
+
+  free(BK_start);
+  free(counts);
+
+  if (BK_passes & 0x1)
+    return (src);
+  else
+    return (trg);
+}
+
+#endif
+
+  //  Allocate a list for kmers k-mers and 2 sentinels, preceded by a header
+
+static void *New_Kmer_List(int64 kmers)
+{ Kmer_Header *h;
+
+  h = (Kmer_Header *) Malloc(sizeof(Kmer_Header) + Ksize*(kmers+2),
+                             "Allocating Sort_Kmers vectors");
+  if (h == NULL)
+    return (NULL);
+  return ((void *) (h+1));
+}
+
+void *Sort_Kmers(DAZZ_DB *block, int64 *len, int nthreads, int verbose)
+{ THREAD    threads[nthreads];
+  Tuple_Arg parmt[nthreads];
+
+  void     *src, *trg, *rez;
+  int64     kmers;
+  int64    *hist, hsize;
+  int64     tcode[nthreads+1];   //  Segment i of the index has its codes at tcode[i] on in
+  int64     ncodes;              //    the code table of ncodes entries
+  int       nreads;
+
+  nreads = block->nreads;
+
+  //  A k-mer's read field holds its read index and orientation, so a block can have
+  //    at most 2^30 reads (its size in bases is not limited)
+
+  if (nreads > 0x40000000)
+    { fprintf(stderr,"%s: Fatal error, DB blocks have more than 2^30 reads!\n",Prog_Name);
+      Clean_Exit(1);
+    }
+
+  if (nreads <= 0)
+    goto no_mers;
+
+  TA_block = block;
+  TA_track = block->tracks;
 
   Cumber[0] = (0x3llu << (Kshift-2));
   Cumber[1] = (0x2llu << (Kshift-2));
   Cumber[2] = (0x1llu << (Kshift-2));
   Cumber[3] = (0x0llu << (Kshift-2));
 
-  //  Determine how many k-tuples will be listed for each thread
-  //    and use that to set up index drop points
+#ifdef AVX2_TUPLES
+  Use_AVX2 = (Allow_AVX2 && Window == 0 && __builtin_cpu_supports("avx2"));
+  if (Use_AVX2 && TA_track == NULL)
+    { if (!ONE_PASS)                      //  Only the two-pass build places by read counts
+        { TA_count = (int *) Malloc(sizeof(int)*nreads,"Allocating tuple counts");
+          if (TA_count == NULL)
+            Clean_Exit(1);
+        }
+      Mod_Fold[0] = (0x1llu << 16) % MODULUS;
+      Mod_Fold[1] = (0x1llu << 32) % MODULUS;
+      Mod_Fold[2] = (0x1llu << 48) % MODULUS;
+      Mod_Magic   = (0x1llu << 32) / MODULUS + 1;
+    }
+#endif
+
+  //  Divide the reads evenly among the threads
 
-  { int i, x, z;
+  { int i;
 
     parmt[0].beg = 0;
-    for (i = 1; i < NTHREADS; i++)
-      parmt[i].beg = parmt[i-1].end = (((int64) nreads) * i) / NTHREADS;
-    parmt[NTHREADS-1].end = nreads;
+    for (i = 1; i < nthreads; i++)
+      parmt[i].beg = parmt[i-1].end = (((int64) nreads) * i) / nthreads;
+    parmt[nthreads-1].end = nreads;
+  }
 
-    for (i = 0; i < NTHREADS; i++)
-      pthread_create(threads+i,NULL,mask_thread,parmt+i);
-    for (i = 0; i < NTHREADS; i++)
-      pthread_join(threads[i],NULL);
+  if (ONE_PASS || Window > 0)
 
-    x = 0;
-    for (i = 0; i < NTHREADS; i++)
-      { z = parmt[i].fill;
-        parmt[i].fill = x;
-        x += z;
-      }
-    kmers = x;
+    //  Build the k-mer list of each thread in one pass into a segment of src and then
+    //    pack them (or copy them to a new list if a segment overflowed).  Minimizers are
+    //    always built this way as selecting them costs much more than the modimizer test.
 
-    if (kmers <= 0)
-      goto no_mers;
-  }
+    { int   i;
+      int64 x, room;
+
+      room = 0;
+      for (i = 0; i < nthreads; i++)
+        room += Tuple_Estimate(parmt[i].beg,parmt[i].end);
+
+      src = New_Kmer_List(room);
+      if (src == NULL)
+        Clean_Exit(1);
+
+      x = 0;
+      for (i = 0; i < nthreads; i++)
+        { parmt[i].list = KREC(src,x);
+          parmt[i].fill = 0;
+          parmt[i].own  = 0;
+          if (i == nthreads-1)
+            parmt[i].size = room - x;
+          else
+            parmt[i].size = Tuple_Estimate(parmt[i].beg,parmt[i].end);
+          x += parmt[i].size;
+        }
 
-  //  Allocate k-mer sorting arrays now that # of kmers is known
+      for (i = 0; i < nthreads; i++)
+        pthread_create(threads+i,NULL,tuple_thread,parmt+i);
+      for (i = 0; i < nthreads; i++)
+        pthread_join(threads[i],NULL);
+
+      x = 0;
+      for (i = 0; i < nthreads; i++)
+        x += parmt[i].fill;
+      kmers = x;
+
+      if (verbose)
+        { printf("\n   One-pass build reserved %.2fGb",
+                 (1. * room) / (0x40000000/Ksize));
+          if (kmers > 0)
+            printf(" (%.1f%% slack)",(100. * (room-kmers)) / kmers);
+          fflush(stdout);
+        }
+
+      if (kmers <= 0)
+        { for (i = 0; i < nthreads; i++)
+            if (parmt[i].own)
+              free(parmt[i].list);
+          free(KMER_HEADER(src));
+          if (verbose)
+            printf("\n");
+          goto no_mers;
+        }
+
+      if (Pack_Tuples(parmt,nthreads,src) < 0)
+        { trg = New_Kmer_List(kmers);
+          if (trg == NULL)
+            Clean_Exit(1);
+          Copy_Tuples(parmt,nthreads,trg);
+          free(KMER_HEADER(src));
+          src = trg;
+        }
+      else
+        { Kmer_Header *h;
+
+          h = (Kmer_Header *) Realloc(KMER_HEADER(src),
+                                      sizeof(Kmer_Header) + Ksize*(kmers+2),
+                                      "Trimming Sort_Kmers vector");
+          if (h == NULL)
+            Clean_Exit(1);
+          src = (void *) (h+1);
+        }
+      FR_src = src;
 
-  if (( (Kshift-1)/8 + (TooFrequent < INT32_MAX) ) & 0x1)
-    { src = (KmerPos *) Malloc(sizeof(KmerPos)*(kmers+2),"Allocating Sort_Kmers vectors");
-      trg = (KmerPos *) Malloc(sizeof(KmerPos)*(kmers+2),"Allocating Sort_Kmers vectors");
+      trg = New_Kmer_List(kmers);
+      if (trg == NULL)
+        Clean_Exit(1);
     }
+
   else
-    { trg = (KmerPos *) Malloc(sizeof(KmerPos)*(kmers+2),"Allocating Sort_Kmers vectors");
-      src = (KmerPos *) Malloc(sizeof(KmerPos)*(kmers+2),"Allocating Sort_Kmers vectors");
+
+    //  Determine how many k-tuples will be listed for each thread
+    //    and use that to set up index drop points
+
+    { int   i;
+      int64 x, z;
+
+      for (i = 0; i < nthreads; i++)
+        pthread_create(threads+i,NULL,mask_thread,parmt+i);
+      for (i = 0; i < nthreads; i++)
+        pthread_join(threads[i],NULL);
+
+      x = 0;
+      for (i = 0; i < nthreads; i++)
+        { z = parmt[i].fill;
+          parmt[i].fill = x;
+          x += z;
+        }
+      kmers = x;
+
+      if (kmers <= 0)
+        {
+#ifdef AVX2_TUPLES
+          if (Use_AVX2 && TA_track == NULL)
+            free(TA_count);
+#endif
+          goto no_mers;
+        }
+
+      //  Allocate k-mer sorting arrays now that # of kmers is known
+
+      if (( (Kshift-1)/8 + (TooFrequent < INT32_MAX || HitBudget > 0) ) & 0x1)
+        { src = New_Kmer_List(kmers);
+          trg = New_Kmer_List(kmers);
+        }
+      else
+        { trg = New_Kmer_List(kmers);
+          src = New_Kmer_List(kmers);
+        }
+      if (src == NULL || trg == NULL)
+        Clean_Exit(1);
+
+      //  Build the k-mer list
+
+      FR_src = src;
+
+      for (i = 0; i < nthreads; i++)
+        { parmt[i].list = src;
+          parmt[i].size = INT64_MAX;
+          parmt[i].own  = 0;
+        }
+
+      for (i = 0; i < nthreads; i++)
+        pthread_create(threads+i,NULL,tuple_thread,parmt+i);
+      for (i = 0; i < nthreads; i++)
+        pthread_join(threads[i],NULL);
+
+#ifdef AVX2_TUPLES
+      if (Use_AVX2 && TA_track == NULL)
+        free(TA_count);
+#endif
     }
-  if (src == NULL || trg == NULL)
-    Clean_Exit(1);
 
 #ifdef PROFILE
-  printf("K %d\n",kmers);
+  printf("K %lld\n",kmers);
 #endif
 
-  if (VERBOSE)
+  if (verbose)
     { printf("\n   Kmer count = ");
       Print_Number((int64) kmers,0,stdout);
-      printf("\n   Using %.2fGb of space\n",(1. * kmers) / (0x20000000/sizeof(KmerPos)));
+      printf("\n   Using %.2fGb of space\n",(1. * kmers) / (0x20000000/Ksize));
       fflush(stdout);
     }
 
-  //  Build the k-mer list
-
-  { int i;
-
-    FR_src = src;
-
-    for (i = 0; i < NTHREADS; i++)
-      pthread_create(threads+i,NULL,tuple_thread,parmt+i);
-    for (i = 0; i < NTHREADS; i++)
-      pthread_join(threads[i],NULL);
-  }
-
   //  Sort the k-mer list
 
+#ifdef BUCKET_KMERS
+  rez = Bucket_Sort(kmers,src,trg,nthreads);
+#else
   { int i;
     int mersort[11];
 
@@ -625,126 +1973,207 @@ void *Sort_Kmers(DAZZ_DB *block, int *len)
       mersort[i] = 8+i;
 #else
     for (i = 0; i < (Kmer-1)/4+1; i++)
-      mersort[i] = 17-i;
+      mersort[i] = (Compact ? 11-i : 17-i);
 #endif
     mersort[i] = -1;
 
-    rez = (KmerPos *) LSD_Sort(kmers,src,trg,16,16,mersort);
+    rez = LSD_Sort_Threads(kmers,src,trg,Ksize,Ksize,mersort,nthreads,verbose);
   }
+#endif
 
-  //  Compress frequent tuples if requested
-
-  if (TooFrequent < INT32_MAX && kmers > 0)
-    { int    i, x, z;
-      uint64 h;
-
-      parmt[0].beg = 0;
-      for (i = 1; i < NTHREADS; i++)
-        { x = (((int64) i)*kmers) / NTHREADS;
-          h = rez[x-1].code;
-          while (rez[x].code == h)
+  //  Histogram the code multiplicities, determine the suppression cutoff from -t and -b,
+  //    and compress out the k-mers occurring that often or more if there are any
+
+  hist   = NULL;
+  hsize  = 0;
+  ncodes = 0;
+  Cutoff = TooFrequent;
+  if (kmers > 0)
+    { Hist_Arg parmh[nthreads];
+      int64   *dense;
+      int      i;
+      int64    x, z;
+      uint64   h;
+
+      parmh[0].beg = 0;
+      for (i = 1; i < nthreads; i++)
+        { x = (i*kmers) / nthreads;
+          h = KCODE(rez,x-1,Compact);
+          while (KCODE(rez,x,Compact) == h)
             x += 1;
-          parmt[i-1].end = parmt[i].beg = x;
+          parmh[i-1].end = parmh[i].beg = x;
         }
-      parmt[NTHREADS-1].end = kmers;
+      parmh[nthreads-1].end = kmers;
 
-      if (rez[kmers-1].code == MAX_CODE_64)
-        rez[kmers].code = 0;
+      if (KCODE(rez,kmers-1,Compact) == KMAX(Compact))
+        Set_Kmer(rez,kmers,0,0,0);
       else
-        rez[kmers].code = MAX_CODE_64;
+        Set_Kmer(rez,kmers,KMAX(Compact),0,0);
 
-      if (src == rez)
-        { FR_src = src;
-          FR_trg = rez = trg;
-        }
-      else
-        { FR_src = trg;
-          FR_trg = rez = src;
+      dense = (int64 *) Malloc(sizeof(int64)*HIST_DENSE*nthreads,"Allocating histograms");
+      if (dense == NULL)
+        Clean_Exit(1);
+      for (i = 0; i < nthreads; i++)
+        { parmh[i].hist = dense + i*HIST_DENSE;
+          parmh[i].big  = NULL;
+          parmh[i].mbig = 0;
         }
 
-      for (i = 0; i < NTHREADS; i++)
-        pthread_create(threads+i,NULL,compsize_thread,parmt+i);
-
-      for (i = 0; i < NTHREADS; i++)
+      FR_src = rez;
+      for (i = 0; i < nthreads; i++)
+        pthread_create(threads+i,NULL,compsize_thread,parmh+i);
+      for (i = 0; i < nthreads; i++)
         pthread_join(threads[i],NULL);
 
+      hist = Merge_Hist(parmh,nthreads,&hsize);
+
+      if (HitBudget > 0)
+        { z = Budget_Cutoff(hist,hsize);
+          if (z < Cutoff)
+            Cutoff = z;
+        }
+
       x = 0;
-      for (i = 0; i < NTHREADS; i++)
-        { z = parmt[i].fill;
+      for (i = 0; i < nthreads; i++)
+        { parmt[i].beg  = parmh[i].beg;
+          parmt[i].end  = parmh[i].end;
           parmt[i].fill = x;
-          x += z;
+          x += Kept_Kmers(parmh+i);
+          if (CODE_COUNTS)
+            { tcode[i] = ncodes;
+              ncodes  += Kept_Codes(parmh+i);
+            }
+          free(parmh[i].big);
         }
-      kmers = x;
-
-      for (i = 0; i < NTHREADS; i++)
-        pthread_create(threads+i,NULL,compress_thread,parmt+i);
+      tcode[nthreads] = ncodes;
+      free(dense);
+
+      if (x < kmers)
+        { kmers = x;
+          if (src == rez)
+            { FR_src = src;
+              FR_trg = rez = trg;
+            }
+          else
+            { FR_src = trg;
+              FR_trg = rez = src;
+            }
 
-      for (i = 0; i < NTHREADS; i++)
-        pthread_join(threads[i],NULL);
+          for (i = 0; i < nthreads; i++)
+            pthread_create(threads+i,NULL,compress_thread,parmt+i);
+          for (i = 0; i < nthreads; i++)
+            pthread_join(threads[i],NULL);
+        }
     }
 
-  rez[kmers].code   = MAX_CODE_64;
-  rez[kmers+1].code = 0;
+  Set_Kmer(rez,kmers,KMAX(Compact),0,0);
+  Set_Kmer(rez,kmers+1,0,0,0);
     
   if (src != rez)
-    free(src);
+    free(KMER_HEADER(src));
   else
-    free(trg);
+    free(KMER_HEADER(trg));
 
-#ifdef TEST_KSORT
-  { int i;
+  //  Trim the list and append the histogram (and code table) to it
 
-    printf("\nKMER SORT:\n");
-    for (i = 0 /*100000000*/; i < 100000000+HOW_MANY && i < kmers; i++)
-      { KmerPos *c = rez+i;
-        printf(" %9d:  %6d%c / %6d / %016llx\n",i,c->read>>1,
-                                               (c->read&0x1)?'c':'n',(c->rpos & POST_MASK),c->code);
-      }
-    fflush(stdout);
+  { Kmer_Header *h;
+
+    h = (Kmer_Header *) Realloc(KMER_HEADER(rez),INDEX_SIZE(kmers,hsize,ncodes),
+                                "Appending k-mer histogram");
+    if (h == NULL)
+      Clean_Exit(1);
+    rez = (void *) (h+1);
+    bzero(((char *) rez) + Ksize*(kmers+2),HIST_OFFSET(kmers) - Ksize*(kmers+2));
+    memcpy(((char *) rez) + HIST_OFFSET(kmers),hist,2*sizeof(int64)*hsize);
+    free(hist);
   }
-#endif
 
-#ifdef HISTOGRAM_KSORT
-  { int    hist[100];
-    uint64 ca;
-    int    i, j;
+  { Kmer_Header *h = KMER_HEADER(rez);
+
+    bzero(h,sizeof(Kmer_Header));       //  So that any padding is saved deterministically
+    memcpy(h->magic,INDEX_MAGIC,8);
+    h->version  = INDEX_VERSION;
+    h->rsize    = Ksize;
+    h->kmer     = Kmer;
+    h->modthr   = ModThr;
+    h->window   = Window;
+    h->suppress = Suppress;
+    h->budget   = HitBudget;
+    h->sample   = SUBSAMPLE;
+    h->cutoff   = Cutoff;
+    h->nreads   = nreads;
+    h->totlen   = block->totlen;
+    h->stamp    = 0;
+    h->kmers    = kmers;
+    h->hsize    = hsize;
+    h->ncodes   = ncodes;
+    h->msize    = 0;
+  }
 
-    for (i = 0; i < 100; i++)
-      hist[i] = 0;
+  //  Fill in the code table, each thread taking the codes of its segment of the index
 
-    i = 0;
-    while (i < kmers)
-      { ca = rez[i].code;
-        j = i++;
-        while (rez[i].code == ca)
-          i += 1;
-        if (i-j >= 100)
-          hist[99] += 1;
-        else
-          hist[i-j] += 1;
-      }
+  if (ncodes > 0)
+    { int i;
+
+      FR_src   = rez;
+      FR_trg   = CODE_TABLE(rez);
+      FR_count = CODE_COUNT(rez);
+      for (i = 0; i < nthreads; i++)
+        { parmt[i].beg  = parmt[i].fill;
+          parmt[i].fill = tcode[i];
+        }
+      for (i = 0; i < nthreads-1; i++)
+        parmt[i].end = parmt[i+1].beg;
+      parmt[nthreads-1].end = kmers;
+
+      for (i = 0; i < nthreads; i++)
+        pthread_create(threads+i,NULL,tally_thread,parmt+i);
+      for (i = 0; i < nthreads; i++)
+        pthread_join(threads[i],NULL);
+    }
+
+#ifdef TEST_KSORT
+  { int64 i;
 
-     for (i = 99; i >= 0; i--)
-       printf(" %2d: %6d\n",i,hist[i]);
+    printf("\nKMER SORT:\n");
+    for (i = 0 /*100000000*/; i < 100000000+HOW_MANY && i < kmers; i++)
+      { uint32 r = KREAD(rez,i,Compact);
+
+        printf(" %9lld:  %6d%c / %6d / %016llx\n",i,r>>1,(r&0x1)?'c':'n',
+                                               (KRPOS(rez,i,Compact) & POST_MASK),
+                                               KCODE(rez,i,Compact));
+      }
+    fflush(stdout);
   }
 #endif
 
-  if (VERBOSE)
-    { if (TooFrequent < INT32_MAX)
+  if (verbose)
+    { if (hsize > 0)
+        Print_Hist(KMER_HIST(rez),hsize);
+      if (Cutoff < TooFrequent)
+        printf("   K-mers occurring %lld or more times %s to meet hit budget\n",Cutoff,
+               SUBSAMPLE ? "sampled" : "suppressed");
+      if (Cutoff < INT32_MAX)
         { printf("   Revised kmer count = ");
           Print_Number((int64) kmers,0,stdout);
           printf("\n");
         }
-      printf("   Index occupies %.2fGb\n",(1. * kmers) / (0x40000000/sizeof(KmerPos)));
+      printf("   Index occupies %.2fGb\n",(1. * kmers) / (0x40000000/Ksize));
+      if (ncodes > 0)
+        { printf("   Code table of ");
+          Print_Number(ncodes,0,stdout);
+          printf(" codes occupies %.2fGb\n",
+                 (1. * ncodes * (CSIZE(Compact)+sizeof(uint32))) / 0x40000000);
+        }
       fflush(stdout);
     }
 
   if (kmers <= 0)
-    { free(rez);
+    { free(KMER_HEADER(rez));
       goto no_mers;
     }
 
-  if (kmers > (int64) (MEM_LIMIT/(4*sizeof(KmerPos))))
+  if (kmers > (int64) (MEM_LIMIT/(4*Ksize)))
     { fprintf(stderr,"Warning: Block size too big, index occupies more than 1/4 of");
       if (MEM_LIMIT == MEM_PHYSICAL)
         fprintf(stderr," physical memory (%.1fGb)\n",(1.*MEM_LIMIT)/0x40000000ll);
@@ -761,6 +2190,113 @@ no_mers:
   return (NULL);
 }
 
+void Free_Kmers(void *index)
+{ Kmer_Header *h;
+
+  if (index == NULL)
+    return;
+  h = KMER_HEADER(index);
+  if (h->msize > 0)
+    munmap(h,h->msize);
+  else
+    free(h);
+}
+
+int64 Kmers_Space(int64 len)
+{ return (2*Ksize*(len+2));
+}
+
+  //  Write the index to file iname.  The file is first written under a temporary name and
+  //    then renamed so that concurrent daligner jobs on the same block never see a partial
+  //    file.  Failure to write is not fatal, the index simply is not cached.
+
+void Save_Kmers(char *iname, void *index, uint64 stamp, int verbose)
+{ Kmer_Header *h;
+  char        *tname;
+  FILE        *f;
+  int64        size;
+
+  if (index == NULL)
+    return;
+  h = KMER_HEADER(index);
+
+  tname = (char *) Malloc(strlen(iname)+20,"Allocating index file name");
+  if (tname == NULL)
+    Clean_Exit(1);
+  sprintf(tname,"%s.%d",iname,getpid());
+
+  h->stamp = stamp;
+  size = INDEX_SIZE(h->kmers,h->hsize,h->ncodes);
+
+  f = fopen(tname,"w");
+  if (f == NULL)
+    { fprintf(stderr,"%s: Warning: Cannot write index file %s\n",Prog_Name,iname);
+      free(tname);
+      return;
+    }
+  if (fwrite(h,size,1,f) != 1 || fclose(f) != 0 || rename(tname,iname) != 0)
+    { fprintf(stderr,"%s: Warning: Failed to write index file %s\n",Prog_Name,iname);
+      unlink(tname);
+    }
+  else if (verbose)
+    { printf("   Saved index to %s\n",iname);
+      fflush(stdout);
+    }
+
+  free(tname);
+}
+
+  //  If iname is an index file built for block with the current parameters and stamp,
+  //    then map it and return the index, otherwise return NULL.
+
+void *Load_Kmers(char *iname, DAZZ_DB *block, uint64 stamp, int64 *len, int verbose)
+{ Kmer_Header  hdr, *h;
+  struct stat  st;
+  int          fd;
+
+  fd = open(iname,O_RDONLY);
+  if (fd < 0)
+    return (NULL);
+
+  if (read(fd,&hdr,sizeof(Kmer_Header)) != sizeof(Kmer_Header) || fstat(fd,&st) < 0)
+    goto stale;
+  if (memcmp(hdr.magic,INDEX_MAGIC,8) != 0 || hdr.version != INDEX_VERSION)
+    goto stale;
+  if (hdr.rsize != Ksize || hdr.kmer != Kmer || hdr.modthr != (int) ModThr
+                         || hdr.window != Window || hdr.suppress != Suppress
+                         || hdr.budget != HitBudget || hdr.sample != SUBSAMPLE)
+    goto stale;
+  if (hdr.nreads != block->nreads || hdr.totlen != block->totlen || hdr.stamp != stamp)
+    goto stale;
+  if (CODE_COUNTS && hdr.ncodes == 0)
+    goto stale;
+  if (st.st_size != (off_t) INDEX_SIZE(hdr.kmers,hdr.hsize,hdr.ncodes))
+    goto stale;
+
+  h = (Kmer_Header *) mmap(NULL,st.st_size,PROT_READ|PROT_WRITE,MAP_PRIVATE,fd,0);
+  close(fd);
+  if (h == MAP_FAILED)
+    return (NULL);
+
+  h->msize = st.st_size;
+
+  if (verbose)
+    { printf("   Mapped index %s\n",iname);
+      Print_Hist(KMER_HIST(h+1),h->hsize);
+      printf("   Kmer count = ");
+      Print_Number(h->kmers,0,stdout);
+      printf("\n   Index occupies %.2fGb\n",(1. * h->kmers) / (0x40000000/Ksize));
+      fflush(stdout);
+    }
+
+  *len = h->kmers;
+  return (h+1);
+
+stale:
+  close(fd);
+  return (NULL);
+}
+
 
 /*******************************************************************************************
  *
@@ -768,8 +2304,8 @@ no_mers:
  *
  ********************************************************************************************/
 
-static int find_tuple(uint64 x, KmerPos *a, int n)
-{ int l, r, m;
+static int64 find_tuple(uint64 x, void *a, int64 n)
+{ int64 l, r, m;
 
   // smallest k s.t. a[k].code >= x (or n if does not exist)
 
@@ -777,7 +2313,41 @@ static int find_tuple(uint64 x, KmerPos *a, int n)
   r = n;
   while (l < r)
     { m = ((l+r) >> 1);
-      if (a[m].code < x)
+      if (KCODE(a,m,Compact) < x)
+        l = m+1;
+      else
+        r = m;
+    }
+  return (l);
+}
+
+  //  Return the smallest k >= i s.t. a[k].code >= x, given that a[i].code < x <= a[n].code.
+  //    When B is much larger than A, or heavily suppressed, the next matching code in B
+  //    is often many entries ahead, so after GALLOP_LINEAR single steps the search gallops
+  //    in steps of 2, 4, 8, ... and bisects the last one, taking O(log d) probes to skip d.
+
+static ALWAYS_INLINE int64 gallop_tuple(uint64 x, void *a, int64 i, int64 n, const int cp)
+{ int64 l, r, m, s;
+
+  for (r = i+GALLOP_LINEAR; i < r; i++)
+    if (KCODE(a,i+1,cp) >= x)
+      return (i+1);
+
+  l = i;
+  s = 2;
+  r = l+s;
+  while (r < n && KCODE(a,r,cp) < x)
+    { l = r;
+      s <<= 1;
+      r = l+s;
+    }
+  if (r > n)
+    r = n;
+
+  l += 1;
+  while (l < r)
+    { m = ((l+r) >> 1);
+      if (KCODE(a,m,cp) < x)
         l = m+1;
       else
         r = m;
@@ -787,69 +2357,99 @@ static int find_tuple(uint64 x, KmerPos *a, int n)
 
   //  Determine what *will* be the size of the merged list and histogram of sizes for given cutoffs
 
-static KmerPos  *MG_alist;
-static KmerPos  *MG_blist;
+static void     *MG_alist;
+static void     *MG_blist;
 static DAZZ_DB  *MG_ablock;
 static DAZZ_DB  *MG_bblock;
 static SeedPair *MG_hits;
 static int       MG_self;
 
+  //  If the A block is processed in slices (-S) then count_thread also tallies in rhits[r]
+  //    the # of hits of each A-read r, leaving out those of k-mers with limit or more hits,
+  //    and merge_thread only produces the hits of A-reads in [rlo,rhi).
+
 typedef struct
-  { int    abeg, aend;
-    int    bbeg, bend;
+  { int64  abeg, aend;
+    int64  bbeg, bend;
+    int64  cabeg, caend;   //  Corresponding ranges of the code tables (count_codes)
+    int64  cbbeg, cbend;
     int64  nhits;
     int    limit;
+    int64 *rhits;
+    int    rlo, rhi;
     int64  hitgram[MAXGRAM];
   } Merge_Arg;
 
-static void *count_thread(void *arg)
-{ Merge_Arg  *data   = (Merge_Arg *) arg;
-  KmerPos    *asort  = MG_alist;
-  KmerPos    *bsort  = MG_blist;
+static ALWAYS_INLINE void count_kmers(Merge_Arg *data, const int cp, const int byread)
+{ void       *asort  = MG_alist;
+  void       *bsort  = MG_blist;
   int64      *gram   = data->hitgram;
+  int64      *rhits  = data->rhits;
   int64       nhits  = 0;
-  int         aend   = data->aend;
+  int64       aend   = data->aend;
+  int         limit  = data->limit;
 
   int64  ct;
-  int    ia, ja;
+  int64  ia, ja;
   uint64 ca, da;
 
   ia = data->abeg;
-  ca = asort[ia].code;
+  ca = KCODE(asort,ia,cp);
   if (MG_self)
     { uint32 ar;
-      int    ka;
+      int64  a, ka, dt;
 
       while (1)
         { ja = ka = ia++;
-          ct = 0;
+          ct = dt = 0;
           if (IDENTITY)
             while (1)
-              { da = asort[ia].code;
+              { da = KCODE(asort,ia,cp);
                 if (da != ca)
                   break;
-                ct += (ia-ja);
+                dt  = (ia-ja);
+                ct += dt;
+                if (byread)
+                  rhits[KREAD(asort,ia,cp) >> 1] += dt;
                 ia += 1;
               }
           else
             while (1)
-              { da = asort[ia].code;
+              { da = KCODE(asort,ia,cp);
                 if (da != ca)
                   break;
-                ar = (asort[ia].read & ~0x1u);
-                while (ka < ia && asort[ka].read < ar)
+                ar = (KREAD(asort,ia,cp) & ~0x1u);
+                while (ka < ia && KREAD(asort,ka,cp) < ar)
                   ka += 1;
-                ct += (ka-ja);
+                dt  = (ka-ja);
+                ct += dt;
+                if (byread)
+                  rhits[ar >> 1] += dt;
                 ia += 1;
               }
 
           ca = da;
-          if (ia > aend)
+          if (ia > aend)                 //  Remove the count for the sentinel at aend
             { if (ja >= aend)
                 break;
               ia = aend;
-              ca = asort[ia].code;
-              ct -= (ka-ja);
+              ca = KCODE(asort,ia,cp);
+              ct -= dt;
+              if (byread)
+                rhits[KREAD(asort,ia,cp) >> 1] -= dt;
+            }
+
+          if (byread && ct >= limit)     //  Take back the tallies of a capped k-mer
+            { ka = ja;
+              for (a = ja+1; a < ia; a++)
+                if (IDENTITY)
+                  rhits[KREAD(asort,a,cp) >> 1] -= (a-ja);
+                else
+                  { ar = (KREAD(asort,a,cp) & ~0x1u);
+                    while (ka < a && KREAD(asort,ka,cp) < ar)
+                      ka += 1;
+                    rhits[ar >> 1] -= (ka-ja);
+                  }
             }
 
           nhits += ct;
@@ -858,15 +2458,16 @@ static void *count_thread(void *arg)
         }
     }
   else
-    { int    ib, jb;
+    { int64  ib, jb;
+      int64  bend = data->bend;
       uint64 cb;
 
       ib = data->bbeg;
-      cb = bsort[ib].code;
+      cb = KCODE(bsort,ib,cp);
       while (1)
         { ja = ia++;
           while (1)
-            { da = asort[ia].code;
+            { da = KCODE(asort,ia,cp);
               if (da != ca)
                 break;
               ia += 1;
@@ -876,12 +2477,12 @@ static void *count_thread(void *arg)
             { if (ja >= aend)
                 break;
               ia  = aend;
-              da = asort[ia].code;
+              da = KCODE(asort,ia,cp);
             }
 
-          while (cb < ca)
-            { ib += 1;
-              cb = bsort[ib].code;
+          if (cb < ca)
+            { ib = gallop_tuple(ca,bsort,ib,bend,cp);
+              cb = KCODE(bsort,ib,cp);
             }
           if (cb != ca)
             { ca = da;
@@ -890,7 +2491,7 @@ static void *count_thread(void *arg)
 
           jb = ib++;
           while (1)
-            { cb = bsort[ib].code;
+            { cb = KCODE(bsort,ib,cp);
               if (cb != ca)
                 break;
               ib += 1;
@@ -901,60 +2502,160 @@ static void *count_thread(void *arg)
           nhits += ct;
           if (ct < MAXGRAM)
             gram[ct] += 1;
+          if (byread && ct < limit)
+            { int64 a;
+
+              for (a = ja; a < ia; a++)
+                rhits[KREAD(asort,a,cp) >> 1] += (ib-jb);
+            }
         }
     }
 
   data->nhits = nhits;
+}
+
+  //  With the code tables of both blocks the hits between two distinct blocks are counted
+  //    from a merge of the tables: for a code occurring m times in A and n times in B there
+  //    are m*n hits, as count_kmers finds by running through the occurrences in the indices.
+
+static ALWAYS_INLINE void count_codes(Merge_Arg *data, const int cp)
+{ void   *acode  = CODE_TABLE(MG_alist);
+  void   *bcode  = CODE_TABLE(MG_blist);
+  uint32 *acount = CODE_COUNT(MG_alist);
+  uint32 *bcount = CODE_COUNT(MG_blist);
+  int64  *gram   = data->hitgram;
+  int64   aend   = data->caend;
+  int64   bend   = data->cbend;
+  int64   nhits  = 0;
+
+  int64  ia, ib, ct;
+  uint64 ca, cb;
+
+  ib = data->cbbeg;
+  if (ib >= bend)
+    { data->nhits = 0;
+      return;
+    }
+  cb = TCODE(bcode,ib,cp);
+  for (ia = data->cabeg; ia < aend; ia++)
+    { ca = TCODE(acode,ia,cp);
+      while (cb < ca)
+        { if (++ib >= bend)
+            { data->nhits = nhits;
+              return;
+            }
+          cb = TCODE(bcode,ib,cp);
+        }
+      if (cb != ca)
+        continue;
+      ct = ((int64) acount[ia]) * bcount[ib];
+      nhits += ct;
+      if (ct < MAXGRAM)
+        gram[ct] += 1;
+    }
+
+  data->nhits = nhits;
+}
+
+  //  Index of the first code >= x in the code table of list
+
+static int64 find_code(uint64 x, void *list)
+{ void  *code = CODE_TABLE(list);
+  int64  l, r, m;
+
+  l = 0;
+  r = KMER_HEADER(list)->ncodes;
+  while (l < r)
+    { m = ((l+r) >> 1);
+      if (TCODE(code,m,Compact) < x)
+        l = m+1;
+      else
+        r = m;
+    }
+  return (l);
+}
+
+static void *codes_thread(void *arg)
+{ Merge_Arg *data = (Merge_Arg *) arg;
 
+  if (Compact)
+    count_codes(data,1);
+  else
+    count_codes(data,0);
   return (NULL);
 }
 
-  //  Produce the merged list now that the list has been allocated and
-  //    the appropriate cutoff determined.
+static void *count_thread(void *arg)
+{ Merge_Arg *data = (Merge_Arg *) arg;
 
-static void *merge_thread(void *arg)
-{ Merge_Arg  *data   = (Merge_Arg *) arg;
-  KmerPos    *asort  = MG_alist;
-  KmerPos    *bsort  = MG_blist;
+  if (data->rhits != NULL)
+    { if (Compact)
+        count_kmers(data,1,1);
+      else
+        count_kmers(data,0,1);
+    }
+  else
+    { if (Compact)
+        count_kmers(data,1,0);
+      else
+        count_kmers(data,0,0);
+    }
+  return (NULL);
+}
+
+  //  Produce the merged list now that the list has been allocated and
+  //    the appropriate cutoff determined.  When the blocks are the same (MG_self) a k-mer's
+  //    entries are paired only with those before them, i.e. the B-read is at most (just
+  //    less than if ! IDENTITY) the A-read, so each read pair is aligned but once and
+  //    report_thread outputs the B-read's view of it from the B-trace Local_Alignment
+  //    produces along with the A-trace, halving the hits and alignments of such a block.
+
+static ALWAYS_INLINE void merge_kmers(Merge_Arg *data, const int cp, const int slice)
+{ void       *asort  = MG_alist;
+  void       *bsort  = MG_blist;
   DAZZ_READ  *reads  = MG_bblock->reads;
   SeedPair   *hits   = MG_hits;
   int64       nhits  = data->nhits;
-  int         aend   = data->aend;
+  int64       aend   = data->aend;
   int         limit  = data->limit;
+  uint32      rlo    = data->rlo;
+  uint32      rhi    = data->rhi;
 
   int64  ct;
-  int    ia, ja;
+  int64  ia, ja;
   uint64 ca, da;
   int    nread = MG_ablock->nreads;
 
   ia = data->abeg;
-  ca = asort[ia].code;
+  ca = KCODE(asort,ia,cp);
   if (MG_self)
     { uint32 ar, br;
       uint32 ap, bp;
       uint32 as, bs;
-      int    a, ka;
+      int64  a, ka, dt;
 
       while (1)
         { ja = ka = ia++;
-          ct = 0;
+          ct = dt = 0;
           if (IDENTITY)
             while (1)
-              { da = asort[ia].code;
+              { da = KCODE(asort,ia,cp);
                 if (da != ca)
                   break;
-                ct += (ia-ja);
+                dt  = (ia-ja);
+                ct += dt;
                 ia += 1;
               }
           else
             while (1)
-              { da = asort[ia].code;
+              { da = KCODE(asort,ia,cp);
                 if (da != ca)
                   break;
-                ar = (asort[ia].read & ~0x1u);
-                while (ka < ia && asort[ka].read < ar)
+                ar = (KREAD(asort,ia,cp) & ~0x1u);
+                while (ka < ia && KREAD(asort,ka,cp) < ar)
                   ka += 1;
-                ct += (ka-ja);
+                dt  = (ka-ja);
+                ct += dt;
                 ia += 1;
               }
 
@@ -963,8 +2664,8 @@ static void *merge_thread(void *arg)
             { if (ja >= aend)
                 break;
               ia = aend;
-              ca = asort[ia].code;
-              ct -= (ka-ja);
+              ca = KCODE(asort,ia,cp);
+              ct -= dt;
             }
 
           if (ct >= limit)
@@ -972,15 +2673,17 @@ static void *merge_thread(void *arg)
 
           if (IDENTITY)
             for (ka = ja+1; ka < ia; ka++)
-              { ar = asort[ka].read;
+              { ar = KREAD(asort,ka,cp);
                 as = (ar & SIGN_BIT);
                 ar >>= 1;
-                ap = (asort[ka].rpos & POST_MASK);
+                if (slice && (ar < rlo || ar >= rhi))
+                  continue;
+                ap = (KRPOS(asort,ka,cp) & POST_MASK);
                 for (a = ja; a < ka; a++)
-                  { br = asort[a].read;
+                  { br = KREAD(asort,a,cp);
                     bs = (br & SIGN_BIT);
                     br >>= 1;
-                    bp = asort[a].rpos;
+                    bp = KRPOS(asort,a,cp);
                     if (bs == as)
                       { bp = (bp & POST_MASK);
                         hits[nhits].aread = ar;
@@ -1000,17 +2703,19 @@ static void *merge_thread(void *arg)
               }
           else
             for (ka = ja+1; ka < ia; ka++)
-              { ar = asort[ka].read;
+              { ar = KREAD(asort,ka,cp);
                 as = (ar & SIGN_BIT);
                 ar >>= 1;
-                ap = (asort[ka].rpos & POST_MASK);
+                if (slice && (ar < rlo || ar >= rhi))
+                  continue;
+                ap = (KRPOS(asort,ka,cp) & POST_MASK);
                 for (a = ja; a < ka; a++)
-                  { br = asort[a].read;
+                  { br = KREAD(asort,a,cp);
                     bs = (br & SIGN_BIT);
                     br >>= 1;
                     if (br >= ar)
                       break;
-                    bp = asort[a].rpos;
+                    bp = KRPOS(asort,a,cp);
                     if (bs == as)
                       { bp = (bp & POST_MASK);
                         hits[nhits].aread = ar;
@@ -1031,19 +2736,20 @@ static void *merge_thread(void *arg)
         }
     }
   else
-    { int    ib, jb;
+    { int64  ib, jb;
+      int64  bend = data->bend;
       uint64 cb;
       uint32 ar, br;
       uint32 ap, bp;
       uint32 as, bs;
-      int    a, b;
+      int64  a, b;
 
       ib = data->bbeg;
-      cb = bsort[ib].code;
+      cb = KCODE(bsort,ib,cp);
       while (1)
         { ja = ia++;
           while (1)
-            { da = asort[ia].code;
+            { da = KCODE(asort,ia,cp);
               if (da != ca)
                 break;
               ia += 1;
@@ -1053,12 +2759,12 @@ static void *merge_thread(void *arg)
             { if (ja >= aend)
                 break;
               ia = aend;
-              da = asort[ia].code;
+              da = KCODE(asort,ia,cp);
             }
           
-          while (cb < ca)
-            { ib += 1;
-              cb = bsort[ib].code;
+          if (cb < ca)
+            { ib = gallop_tuple(ca,bsort,ib,bend,cp);
+              cb = KCODE(bsort,ib,cp);
             }
           if (cb != ca)
             { ca = da;
@@ -1067,7 +2773,7 @@ static void *merge_thread(void *arg)
           
           jb = ib++;
           while (1) 
-            { cb = bsort[ib].code;
+            { cb = KCODE(bsort,ib,cp);
               if (cb != ca)
                 break;
               ib += 1;
@@ -1078,15 +2784,17 @@ static void *merge_thread(void *arg)
             continue;
 
           for (a = ja; a < ia; a++)
-            { ar = asort[a].read;
+            { ar = KREAD(asort,a,cp);
               as = (ar & SIGN_BIT);
               ar >>= 1;
-              ap = (asort[a].rpos & POST_MASK);
+              if (slice && (ar < rlo || ar >= rhi))
+                continue;
+              ap = (KRPOS(asort,a,cp) & POST_MASK);
               for (b = jb; b < ib; b++)
-                { br = bsort[b].read;
+                { br = KREAD(bsort,b,cp);
                   bs = (br & SIGN_BIT);
                   br >>= 1;
-                  bp = bsort[b].rpos;
+                  bp = KRPOS(bsort,b,cp);
                   if (bs == as)
                     { bp = (bp & POST_MASK);
                       hits[nhits].aread = ar;
@@ -1107,11 +2815,27 @@ static void *merge_thread(void *arg)
 
         }
     }
+}
+
+static void *merge_thread(void *arg)
+{ Merge_Arg *data = (Merge_Arg *) arg;
 
+  if (data->rhits != NULL)
+    { if (Compact)
+        merge_kmers(data,1,1);
+      else
+        merge_kmers(data,0,1);
+    }
+  else
+    { if (Compact)
+        merge_kmers(data,1,0);
+      else
+        merge_kmers(data,0,0);
+    }
   return (NULL);
 }
 
-  //  Report threads: given a segment of merged list, find all seeds and from them all alignments.
+  //  Report threads: given chunks of the merged list, find all seeds and from them all alignments.
 
 static DAZZ_DB    *MR_ablock;
 static DAZZ_DB    *MR_bblock;
@@ -1119,6 +2843,39 @@ static SeedPair   *MR_hits;
 static int         MR_two;
 static Align_Spec *MR_spec;
 static int         MR_tspace;
+static int         MR_panel;    //  Hits of an A-read are scored in panels of this size
+static int         MR_povlp;    //    overlapping by this much
+
+  //  The merged list is cut into MR_nchunk chunks, chunk c being [MR_chunk[c],MR_chunk[c+1]),
+  //    at B-read boundaries.  A report thread claims the next unclaimed chunk each time it
+  //    finishes one, so that a few read pairs with costly alignments do not hold up the rest.
+
+static int64          *MR_chunk;
+static int             MR_nchunk;
+static int             MR_next;
+static pthread_mutex_t MR_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int next_chunk(int64 *beg, int64 *end)
+{ int c;
+
+  pthread_mutex_lock(&MR_lock);
+  c = MR_next;
+  if (c < MR_nchunk)
+    MR_next = c+1;
+  pthread_mutex_unlock(&MR_lock);
+  if (c >= MR_nchunk)
+    return (0);
+  *beg = MR_chunk[c];
+  *end = MR_chunk[c+1];
+  return (1);
+}
+
+static double wall_clock()
+{ struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC,&t);
+  return (t.tv_sec + 1e-9*t.tv_nsec);
+}
 
 typedef struct
   { uint64   max;
@@ -1839,16 +3596,551 @@ static void CopyAndComp(char *bcomp,char *bseq, int blen)
   t[0] = 4;
 }
 
+  //  The seeds of a read pair, i.e. the hits whose diagonal band scores >= Hitmin in a panel.
+  //    If CHAIN_SEEDS then they are first grouped into chains of colinear seeds, and an
+  //    alignment is launched from the best scoring seed of each chain, biggest chain first,
+  //    and then from any seed of the chain not covered by an alignment found so far.
+
+typedef struct
+  { int apos;       //  A- and B-position of the seed hit
+    int bpos;
+    int diag;       //  Diagonal bin of the hit
+    int score;      //  Score of the band the hit qualified in
+    int chain;      //  Chain of the seed (CHAIN_SEEDS)
+    int cover;      //  Seed lies within an alignment found so far (CHAIN_SEEDS)
+  } Seed;
+
+typedef struct
+  { int lapos;      //  A-position and diagonal of the last seed of the chain
+    int ldiag;
+    int best;       //  Index of the best scoring seed of the chain
+    int nseed;      //  # of seeds in the chain
+    int rank;       //  Rank of the chain in decreasing order of size
+  } Chain;
+
+#define SEED_MASK  0x7fffffffllu
+
+typedef struct
+  { int     max;
+    int     nseed;
+    Seed   *seed;
+    uint64 *order;  //  Launch order: (chain rank, not best, seed index) triples
+    int     cmax;
+    Chain  *chain;
+  } Seed_List;
+
+  //  Chain the seeds (in A-order) of slist greedily: a seed extends the chain among the
+  //    CHAIN_LOOK most recent ones whose last seed is nearest to it in diagonal, provided
+  //    the diagonals differ by at most a bin width plus 1/CHAIN_DRIFT of the A-distance
+  //    between them, and otherwise starts a new chain.  Then set the launch order.
+
+static void Chain_Seeds(Seed_List *slist)
+{ Seed   *seed  = slist->seed;
+  int     nseed = slist->nseed;
+  Chain  *chain = slist->chain;
+  uint64 *order;
+  int     nchain;
+  int     i, c, d, e, best, dev;
+
+  if (nseed == 0)
+    return;
+
+  if (nseed > slist->cmax)
+    { slist->cmax  = 1.2*nseed + SEED_CHUNK;
+      slist->chain = chain = Realloc(chain,sizeof(Chain)*slist->cmax,"Reallocating chains");
+      slist->order = Realloc(slist->order,sizeof(uint64)*slist->cmax,"Reallocating chains");
+      if (chain == NULL || slist->order == NULL)
+        Clean_Exit(1);
+    }
+  order = slist->order;
+
+  nchain = 0;
+  for (i = 0; i < nseed; i++)
+    { d = seed[i].apos - seed[i].bpos;
+      best = -1;
+      dev  = 0;
+      for (c = nchain-1; c >= 0 && c >= nchain-CHAIN_LOOK; c--)
+        { e = abs(d - chain[c].ldiag);
+          if (e <= (1 << Binshift) + (seed[i].apos - chain[c].lapos) / CHAIN_DRIFT)
+            if (best < 0 || e < dev)
+              { best = c;
+                dev  = e;
+              }
+        }
+      if (best < 0)
+        { best = nchain++;
+          chain[best].best  = i;
+          chain[best].nseed = 0;
+        }
+      else if (seed[i].score > seed[chain[best].best].score)
+        chain[best].best = i;
+      chain[best].lapos  = seed[i].apos;
+      chain[best].ldiag  = d;
+      chain[best].nseed += 1;
+      seed[i].chain = best;
+    }
+
+  //  Rank the chains (order is used as scratch)
+
+  for (c = 0; c < nchain; c++)
+    order[c] = (((uint64) (nseed - chain[c].nseed)) << 32) | c;
+  qsort(order,nchain,sizeof(uint64),int64_cmp);
+  for (c = 0; c < nchain; c++)
+    chain[order[c] & SEED_MASK].rank = c;
+
+  for (i = 0; i < nseed; i++)
+    { c = seed[i].chain;
+      order[i] = (((uint64) chain[c].rank) << 32) | i;
+      if (chain[c].best != i)
+        order[i] |= 0x80000000llu;
+    }
+  qsort(order,nseed,sizeof(uint64),int64_cmp);
+}
+
+  //  Mark as covered the seeds in diagonals [low,hgh] between A-positions abpos and aepos
+
+static void Cover_Seeds(Seed_List *slist, int low, int hgh, int abpos, int aepos)
+{ Seed *seed = slist->seed;
+  int   i;
+
+  for (i = slist->nseed-1; i >= 0; i--)
+    if (seed[i].diag >= low && seed[i].diag <= hgh &&
+        seed[i].apos >= abpos && seed[i].apos <= aepos)
+      seed[i].cover = 1;
+}
+
+  //  A .las file being written by a report thread: overlap records are formatted into a
+  //    LAS_BUFFER arena that is written out with a single pwrite whenever it fills, so that
+  //    a file system on which small writes are expensive (e.g. a shared parallel one at -P)
+  //    sees only large ones.  If DIRECT_IO then the file is opened with O_DIRECT where that
+  //    is supported, all but the final write being whole DIRECT_ALIGN blocks.
+  //  If MEMORY_SORT then the output is instead held in memory, the arena growing to hold
+  //    every record, until the arenas of all the threads together would exceed MR_budget
+  //    bytes, whereupon the arena is "spilled", i.e. the file is opened and the arena
+  //    henceforth treated as a buffer for it, its space beyond LAS_BUFFER being given back.
+  //    In memory each record starts at an offset such that the Overlap it is read as (whose
+  //    trace pointer is not stored) is aligned, the padding being squeezed out on a spill.
+
+typedef struct
+  { int    fd;
+    int    direct;  //  fd is open with O_DIRECT
+    int    memory;  //  All the records are in buf (the file is not yet open)
+    char  *name;    //    and if they do not fit then they go to this file
+    char  *buf;
+    int64  size;    //  Size of buf
+    int64  top;     //  buf[0..top) is pending
+    int64  off;     //  File offset of buf[0]
+  } Las_Output;
+
+static int64 MR_budget;   //  Bytes the in-memory .las arenas may occupy (-1 => no limit)
+static int64 MR_used;     //    and the bytes they do occupy
+
+#define OVL_ALIGN   ((int64) _Alignof(Overlap))
+#define OVL_HEAD    ((int64) (sizeof(Overlap) - sizeof(void *)))
+
+  //  Offset at or after x at which an in-memory record starts
+
+#define OVL_START(x)  ((((x) - ((int64) sizeof(void *)) + (OVL_ALIGN-1)) & ~(OVL_ALIGN-1)) \
+                        + ((int64) sizeof(void *)))
+
+static char *Las_Buffer(int64 size)
+{ void *buf = NULL;
+
+  if (posix_memalign(&buf,DIRECT_ALIGN,size) != 0)
+    { fprintf(stderr,"%s: Out of memory (Allocating output buffer)\n",Prog_Name);
+      Clean_Exit(1);
+    }
+  return ((char *) buf);
+}
+
+static void Create_Las(Las_Output *out, char *fname)
+{ int flags;
+
+  flags = O_WRONLY | O_CREAT | O_TRUNC;
+  out->direct = 0;
+  out->fd     = -1;
+#ifdef O_DIRECT
+  if (DIRECT_IO)
+    { out->fd = open(fname,flags | O_DIRECT,0666);
+      if (out->fd >= 0)
+        out->direct = 1;
+      else if (errno == EINVAL && VERBOSE)
+        fprintf(stderr,"%s: Warning: %s does not support O_DIRECT\n",Prog_Name,SORT_PATH);
+    }
+#endif
+  if (out->fd < 0)
+    out->fd = open(fname,flags,0666);
+  if (out->fd < 0)
+    { fprintf(stderr,"%s: Cannot open %s for writing\n",Prog_Name,fname);
+      Clean_Exit(1);
+    }
+}
+
+static void Flush_Las(Las_Output *out, int final)
+{ int64 n, w, x;
+
+#ifdef O_DIRECT
+  if (final && out->direct)
+    { fcntl(out->fd,F_SETFL,fcntl(out->fd,F_GETFL) & ~O_DIRECT);
+      out->direct = 0;
+    }
+#endif
+
+  n = out->top;
+  if (out->direct)
+    n &= ~((int64) (DIRECT_ALIGN-1));
+  for (w = 0; w < n; w += x)
+    { x = pwrite(out->fd,out->buf+w,n-w,out->off+w);
+      if (x <= 0)
+        { fprintf(stderr,"%s: Cannot write to %s, too small?\n",Prog_Name,SORT_PATH);
+          Clean_Exit(1);
+        }
+    }
+  out->top -= n;
+  out->off += n;
+  if (out->top > 0)
+    memmove(out->buf,out->buf+n,out->top);
+}
+
+  //  Squeeze the alignment padding out of the (whole) records of an in-memory output
+
+static void Pack_Las(Las_Output *out)
+{ Overlap *ovl;
+  int64    r, w, len;
+  int      tbytes;
+
+  if (MR_tspace <= TRACE_XOVR)
+    tbytes = sizeof(uint8);
+  else
+    tbytes = sizeof(uint16);
+
+  r = w = sizeof(int64) + sizeof(int);
+  while (r < out->top)
+    { r   = OVL_START(r);
+      ovl = (Overlap *) (out->buf + (r - sizeof(void *)));
+      len = OVL_HEAD + ((int64) tbytes)*ovl->path.tlen;
+      memmove(out->buf+w,out->buf+r,len);
+      r += len;
+      w += len;
+    }
+  out->top = w;
+}
+
+  //  Turn an in-memory output into a buffered file, returning its arena to the budget
+
+static void Spill_Las(Las_Output *out)
+{ char *buf;
+
+  Pack_Las(out);
+  Create_Las(out,out->name);
+  out->memory = 0;
+  Flush_Las(out,0);
+
+  pthread_mutex_lock(&MR_lock);
+  MR_used -= out->size;
+  pthread_mutex_unlock(&MR_lock);
+
+  if (out->size > LAS_BUFFER)
+    { buf = Las_Buffer(LAS_BUFFER);
+      memcpy(buf,out->buf,out->top);
+      free(out->buf);
+      out->buf  = buf;
+      out->size = LAS_BUFFER;
+    }
+}
+
+  //  Make room for need bytes in the arena of an in-memory output if the budget permits,
+  //    otherwise spill it to its file
+
+static void Grow_Las(Las_Output *out, int64 need)
+{ int64 size;
+  char *buf;
+  int   fits;
+
+  size = 2*out->size;
+  if (size < need)
+    size = need;
+  size = (size + (DIRECT_ALIGN-1)) & ~((int64) (DIRECT_ALIGN-1));
+
+  pthread_mutex_lock(&MR_lock);
+  fits = (MR_budget < 0 || MR_used + (size - out->size) <= MR_budget);
+  if (fits)
+    MR_used += size - out->size;
+  pthread_mutex_unlock(&MR_lock);
+
+  if (fits)
+    { buf = Las_Buffer(size);
+      memcpy(buf,out->buf,out->top);
+      free(out->buf);
+      out->buf  = buf;
+      out->size = size;
+    }
+  else
+    Spill_Las(out);
+}
+
+static void Put_Las(Las_Output *out, void *data, int64 len)
+{ char *src = (char *) data;
+  int64 n;
+
+  if (out->memory && out->top + len > out->size)
+    Grow_Las(out,out->top+len);
+  while (len > 0)
+    { n = out->size - out->top;
+      if (n > len)
+        n = len;
+      memcpy(out->buf+out->top,src,n);
+      out->top += n;
+      src      += n;
+      len      -= n;
+      if (out->top >= out->size && ! out->memory)
+        Flush_Las(out,0);
+    }
+}
+
+  //  Add the record of ovl and its trace of tbytes sized entries to out
+
+static void Put_Ovl(Las_Output *out, Overlap *ovl, int tbytes)
+{ int64 tlen = ((int64) tbytes)*ovl->path.tlen;
+  int64 beg;
+
+  if (out->memory)
+    { beg = OVL_START(out->top);
+      if (beg + OVL_HEAD + tlen > out->size)
+        Grow_Las(out,beg + OVL_HEAD + tlen);
+      if (out->memory)
+        out->top = beg;
+    }
+  Put_Las(out,((char *) ovl) + sizeof(void *),OVL_HEAD);
+  Put_Las(out,ovl->path.trace,tlen);
+}
+
+  //  Open fname for writing .las records, putting a header with a zero count first.  If
+  //    memory then the records are kept in memory as described above.
+
+static void Open_Las(Las_Output *out, char *fname, int memory)
+{ int64 zero = 0;
+
+  out->memory = memory;
+  if (memory)
+    { out->name = Strdup(fname,"Allocating .las file name");
+      if (out->name == NULL)
+        Clean_Exit(1);
+      out->fd     = -1;
+      out->direct = 0;
+      pthread_mutex_lock(&MR_lock);
+      MR_used += LAS_BUFFER;
+      pthread_mutex_unlock(&MR_lock);
+    }
+  else
+    { out->name = NULL;
+      Create_Las(out,fname);
+    }
+
+  out->buf  = Las_Buffer(LAS_BUFFER);
+  out->size = LAS_BUFFER;
+  out->top  = 0;
+  out->off  = 0;
+  Put_Las(out,&zero,sizeof(int64));
+  Put_Las(out,&MR_tspace,sizeof(int));
+}
+
+  //  Write out what remains, set the overlap count of the header to novl, and close.  An
+  //    in-memory output just has its count set unless spill is set, in which case it is
+  //    written to its file first.
+
+static void Close_Las(Las_Output *out, int64 novl, int spill)
+{ if (out->memory)
+    { memcpy(out->buf,&novl,sizeof(int64));
+      if ( ! spill)
+        return;
+      Spill_Las(out);
+    }
+  Flush_Las(out,1);
+  if (pwrite(out->fd,&novl,sizeof(int64),0) != sizeof(int64))
+    { fprintf(stderr,"%s: Cannot write to %s, too small?\n",Prog_Name,SORT_PATH);
+      Clean_Exit(1);
+    }
+  close(out->fd);
+  free(out->buf);
+  free(out->name);
+}
+
+  //  Sort and merge in-memory .las outputs.  Each is sorted in place (well, a vector of
+  //    pointers to its records is) by a thread of its own in the order LAsort would, and then
+  //    the runs are merged with a heap in the order LAmerge would, ties going to the run of
+  //    the lower numbered thread, so the result is identical to that of the file route.
+
+typedef struct
+  { Las_Output *out;    //  Output holding the run (its header gives the # of records)
+    Overlap   **perm;   //  Sorted pointers to the records of the run
+    int64       novl;   //  # of records
+    int64       next;   //  Index in perm of the next record to merge
+  } Las_Run;
+
+static inline int las_order(Overlap *l, Overlap *r)
+{ if (l->aread != r->aread)
+    return (l->aread - r->aread);
+  if ( ! MAP_ORDER)
+    { if (l->bread != r->bread)
+        return (l->bread - r->bread);
+      if (COMP(l->flags) != COMP(r->flags))
+        return (COMP(l->flags) - COMP(r->flags));
+    }
+  return (l->path.abpos - r->path.abpos);
+}
+
+static int las_sort(const void *x, const void *y)
+{ Overlap *l = *((Overlap **) x);
+  Overlap *r = *((Overlap **) y);
+  int      c;
+
+  c = las_order(l,r);
+  if (c != 0)
+    return (c);
+  if (l < r)
+    return (-1);
+  else if (l > r)
+    return (1);
+  else
+    return (0);
+}
+
+static void *sort_thread(void *arg)
+{ Las_Run *run = (Las_Run *) arg;
+  int      tbytes;
+  int64    i, off;
+
+  if (MR_tspace <= TRACE_XOVR)
+    tbytes = sizeof(uint8);
+  else
+    tbytes = sizeof(uint16);
+
+  run->novl = *((int64 *) run->out->buf);
+  run->perm = (Overlap **) Malloc(sizeof(Overlap *)*(run->novl+1),"Allocating sort vector");
+  if (run->perm == NULL)
+    Clean_Exit(1);
+
+  off = sizeof(int64) + sizeof(int);
+  for (i = 0; i < run->novl; i++)
+    { off = OVL_START(off);
+      run->perm[i] = (Overlap *) (run->out->buf + (off - sizeof(void *)));
+      off += OVL_HEAD + ((int64) tbytes)*run->perm[i]->path.tlen;
+    }
+  qsort(run->perm,run->novl,sizeof(Overlap *),las_sort);
+
+  run->next = 0;
+  return (NULL);
+}
+
+static inline int run_less(Las_Run *l, Las_Run *r)
+{ int c;
+
+  c = las_order(l->perm[l->next],r->perm[r->next]);
+  return (c < 0 || (c == 0 && l < r));
+}
+
+static void run_heap(int s, Las_Run **heap, int hsize)
+{ int      c, l, r;
+  Las_Run *hs;
+
+  c  = s;
+  hs = heap[s];
+  while ((l = 2*c) <= hsize)
+    { r = l+1;
+      if (r <= hsize && run_less(heap[r],heap[l]))
+        l = r;
+      if ( ! run_less(heap[l],hs))
+        break;
+      heap[c] = heap[l];
+      c = l;
+    }
+  heap[c] = hs;
+}
+
+  //  Sort the nrun in-memory outputs in run and merge them into the .las file fname.
+  //    The outputs are freed.
+
+static void Merge_Las(Las_Run *run, int nrun, char *fname)
+{ Las_Run    *heap[nrun+1];
+  Las_Output  out;
+  Overlap    *ovl;
+  int64       novl;
+  int         i, hsize, tbytes;
+
+  if (MR_tspace <= TRACE_XOVR)
+    tbytes = sizeof(uint8);
+  else
+    tbytes = sizeof(uint16);
+
+#ifdef NOTHREAD
+
+  for (i = 0; i < nrun; i++)
+    sort_thread(run+i);
+
+#else
+
+  { THREAD threads[nrun];
+
+    for (i = 0; i < nrun; i++)
+      pthread_create(threads+i,NULL,sort_thread,run+i);
+
+    for (i = 0; i < nrun; i++)
+      pthread_join(threads[i],NULL);
+  }
+
+#endif
+
+  Open_Las(&out,fname,0);
+
+  novl  = 0;
+  hsize = 0;
+  for (i = 0; i < nrun; i++)
+    if (run[i].novl > 0)
+      heap[++hsize] = run+i;
+  for (i = hsize/2; i >= 1; i--)
+    run_heap(i,heap,hsize);
+
+  while (hsize > 0)
+    { ovl = heap[1]->perm[heap[1]->next];
+      Put_Las(&out,((char *) ovl) + sizeof(void *),OVL_HEAD + ovl->path.tlen*tbytes);
+      novl += 1;
+      if (++heap[1]->next >= heap[1]->novl)
+        heap[1] = heap[hsize--];
+      run_heap(1,heap,hsize);
+    }
+
+  Close_Las(&out,novl,0);
+
+  for (i = 0; i < nrun; i++)
+    { free(run[i].perm);
+      free(run[i].out->buf);
+      free(run[i].out->name);
+    }
+
+  if (VERBOSE)
+    { printf("\n   Sorted and merged ");
+      Print_Number(novl,0,stdout);
+      printf(" overlaps from %d threads into %s in memory\n",nrun,fname);
+      fflush(stdout);
+    }
+}
+
 typedef struct
-  { int64       beg, end;
-    int        *score;
+  { int        *score;
     int        *lastp;
     int        *lasta;
     Work_Data  *work;
-    FILE       *ofile1;
-    FILE       *ofile2;
+    Las_Output *ofile1;
+    Las_Output *ofile2;
+    int64       ahits;     //  # of overlaps written to ofile1 and ofile2
+    int64       bhits;
     int64       nfilt;
     int64       nlas;
+    int64       npanel;    //  # of panels scored
+    int64       nredun;    //  # of alignments removed by Handle_Redundancies
+    int64       nchunk;    //  # of chunks processed
+    double      busy;      //  Seconds spent processing them
 #ifdef PROFILE
     int         profyes[MAXHIT+1];
     int         profno[MAXHIT+1];
@@ -1875,8 +4167,8 @@ static void *report_thread(void *arg)
   int         *lasta  = data->lasta;
   int          afirst = MR_ablock->tfirst;
   int          bfirst = MR_bblock->tfirst;
-  FILE        *ofile1 = data->ofile1;
-  FILE        *ofile2 = data->ofile2;
+  Las_Output  *ofile1 = data->ofile1;
+  Las_Output  *ofile2 = data->ofile2;
   Work_Data   *work   = data->work;
   int          maxdiag = ( MR_ablock->maxlen >> Binshift);
   int          mindiag = (-MR_bblock->maxlen >> Binshift);
@@ -1900,16 +4192,24 @@ static void *report_thread(void *arg)
   Trace_Buffer _tbuf, *tbuf = &_tbuf;
   int          small, tbytes;
 
+  Seed_List _slist, *slist = &_slist;
+
   Double *hitc;
   int     minhit;
   uint64  cpair;
   uint64  npair = 0;
   int64   nidx, eidx;
 
-  int64 nfilt = 0;
-  int64 nlas  = 0;
-  int64 ahits = 0;
-  int64 bhits = 0;
+  int64 nfilt  = 0;
+  int64 nlas   = 0;
+  int64 ahits  = 0;
+  int64 bhits  = 0;
+  int64 npanel = 0;
+  int64 nredun = 0;
+  int64 nchunk = 0;
+  double start;
+
+  start = wall_clock();
 
   //  In ovl and align roles of A and B are reversed, as the B sequence must be the
   //    complemented sequence !!
@@ -1936,12 +4236,13 @@ static void *report_thread(void *arg)
   if (amatch == NULL || bmatch == NULL || tbuf->trace == NULL)
     Clean_Exit(1);
 
-  fwrite(&ahits,sizeof(int64),1,ofile1);
-  fwrite(&MR_tspace,sizeof(int),1,ofile1);
-  if (MR_two)
-    { fwrite(&bhits,sizeof(int64),1,ofile2);
-      fwrite(&MR_tspace,sizeof(int),1,ofile2);
-    }
+  slist->max   = SEED_CHUNK;
+  slist->seed  = Malloc(sizeof(Seed)*slist->max,"Allocating seed vector");
+  slist->order = NULL;
+  slist->cmax  = 0;
+  slist->chain = NULL;
+  if (slist->seed == NULL)
+    Clean_Exit(1);
 
 #ifdef PROFILE
   { int i;
@@ -1952,300 +4253,332 @@ static void *report_thread(void *arg)
 
   minhit = (Hitmin-1)/Kmer + 1;
   hitc   = hitd + (minhit-1);
-  eidx   = data->end - minhit;
-  nidx   = data->beg;
-  for (cpair = hitd[nidx].p1; nidx <= eidx; cpair = npair)
-    if (hitc[nidx].p1 != cpair)
-      { nidx += 1;
-        while ((npair = hitd[nidx].p1) == cpair)
-          nidx += 1;
-      }
-    else
-      { int   ar, br, bc;
-        int   alen, blen;
-        int   doA, doB;
-        int   setaln, amark, amark2;
-        int   apos, bpos, diag;
-        int64 lidx, sidx;
-        int64 f, h2;
-
-        ar = hits[nidx].aread;
-        br = hits[nidx].bread;
-        if (ar >= areads)
-          { bc = 1;
-            ar -= areads;
-          }
-        else
-          bc = 0;
-        alen = aread[ar].rlen;
-        blen = bread[br].rlen;
-        doA  = (alen >= HGAP_MIN);
-        doB  = (SYMMETRIC && blen >= HGAP_MIN && ! (ar == br && MG_self));
-        if (! (doA || doB))
+  while (next_chunk(&nidx,&eidx))
+    { eidx   -= minhit;
+      nchunk += 1;
+      for (cpair = hitd[nidx].p1; nidx <= eidx; cpair = npair)
+        if (hitc[nidx].p1 != cpair)
           { nidx += 1;
             while ((npair = hitd[nidx].p1) == cpair)
               nidx += 1;
-            continue;
           }
+        else
+          { int   ar, br, bc;
+            int   alen, blen;
+            int   doA, doB;
+            int   setaln, amark, amark2;
+            int   apos, bpos, diag;
+            int64 lidx, sidx;
+            int64 f, h2, k, lastf;
+
+            ar = hits[nidx].aread;
+            br = hits[nidx].bread;
+            if (ar >= areads)
+              { bc = 1;
+                ar -= areads;
+              }
+            else
+              bc = 0;
+            alen = aread[ar].rlen;
+            blen = bread[br].rlen;
+            doA  = (alen >= HGAP_MIN);
+            doB  = (SYMMETRIC && blen >= HGAP_MIN && ! (ar == br && MG_self));
+            if (! (doA || doB))
+              { nidx += 1;
+                while ((npair = hitd[nidx].p1) == cpair)
+                  nidx += 1;
+                continue;
+              }
 
 #ifdef TEST_GATHER
-        printf("%5d vs %5d%c : %5d x %5d\n",ar+afirst,br+bfirst,bc?'c':'n',alen,blen);
-        fflush(stdout);
+            printf("%5d vs %5d%c : %5d x %5d\n",ar+afirst,br+bfirst,bc?'c':'n',alen,blen);
+            fflush(stdout);
 #endif
-        setaln = 1;
-        amark2 = 0;
-        novl   = 0;
-        tbuf->top = 0;
-        for (sidx = nidx; hitd[nidx].p1 == cpair; nidx = h2)
-          { amark  = amark2 + PANEL_SIZE;
-            amark2 = amark  - PANEL_OVERLAP;
-
-            h2 = lidx = nidx;
-            do
-              { apos  = hits[nidx].apos;
-                npair = hitd[++nidx].p1;
-                if (apos <= amark2)
-                  h2 = nidx;
-              }
-            while (npair == cpair && apos <= amark);
+            setaln = 1;
+            amark2 = 0;
+            novl   = 0;
+            lastf  = -1;
+            tbuf->top = 0;
+            slist->nseed = 0;
+            for (sidx = nidx; hitd[nidx].p1 == cpair; nidx = h2)
+              { amark  = amark2 + MR_panel;
+                amark2 = amark  - MR_povlp;
+
+                h2 = lidx = nidx;
+                do
+                  { apos  = hits[nidx].apos;
+                    npair = hitd[++nidx].p1;
+                    if (apos <= amark2)
+                      h2 = nidx;
+                  }
+                while (npair == cpair && apos <= amark);
 
-            if (nidx-lidx < minhit) continue;
+                if (nidx-lidx < minhit) continue;
 
-            for (f = lidx; f < nidx; f++)
-              { apos = hits[f].apos;
-                diag = hits[f].diag >> Binshift;
-                if (apos - lastp[diag] >= Kmer)
-                  score[diag] += Kmer;
-                else
-                  score[diag] += apos - lastp[diag];
-                lastp[diag] = apos;
-              }
+                npanel += 1;
+
+                for (f = lidx; f < nidx; f++)
+                  { apos = hits[f].apos;
+                    diag = hits[f].diag >> Binshift;
+                    if (apos - lastp[diag] >= Kmer)
+                      score[diag] += Kmer;
+                    else
+                      score[diag] += apos - lastp[diag];
+                    lastp[diag] = apos;
+                  }
 
 #ifdef TEST_GATHER
-            printf("  %6lld upto %6d",nidx-lidx,amark);
-            fflush(stdout);
+                printf("  %6lld upto %6d",nidx-lidx,amark);
+                fflush(stdout);
 #endif
 
-            for (f = lidx; f < nidx; f++)
-              { apos = hits[f].apos;
-                diag = hits[f].diag;
-                bpos = apos - diag;
-                diag = diag >> Binshift;
-                if (apos > lasta[diag] &&
-                     (score[diag] + scorp[diag] >= Hitmin || score[diag] + scorm[diag] >= Hitmin))
-                  { if (setaln)
-                      { setaln = 0;
-                        align->aseq = aseq + aread[ar].boff;
-                        align->bseq = bseq + bread[br].boff;
-                        if (bc)
-                          { CopyAndComp(bcomp,align->bseq,blen);
-                            align->bseq = bcomp;
+                for (f = lidx; f < nidx; f++)
+                  { diag = hits[f].diag >> Binshift;
+                    if (score[diag] + scorp[diag] >= Hitmin || score[diag] + scorm[diag] >= Hitmin)
+                      { Seed *sd;
+
+                        if (CHAIN_SEEDS && f <= lastf)
+                          continue;
+                        lastf = f;
+                        if (slist->nseed >= slist->max)
+                          { slist->max  = 1.2*slist->nseed + SEED_CHUNK;
+                            slist->seed = Realloc(slist->seed,sizeof(Seed)*slist->max,
+                                                  "Reallocating seed vector");
+                            if (slist->seed == NULL)
+                              Clean_Exit(1);
                           }
-                        align->alen = alen;
-                        align->blen = blen;
-                        align->flags = ovla->flags = ovlb->flags = bc;
-                        ovlb->bread = ovla->aread = ar + afirst;
-                        ovlb->aread = ovla->bread = br + bfirst;
+                        sd = slist->seed + slist->nseed++;
+                        sd->apos  = hits[f].apos;
+                        sd->bpos  = sd->apos - hits[f].diag;
+                        sd->diag  = diag;
+                        sd->cover = 0;
+                        if (scorm[diag] > scorp[diag])
+                          sd->score = score[diag] + scorm[diag];
+                        else
+                          sd->score = score[diag] + scorp[diag];
+                      }
+                  }
+
+                for (f = lidx; f < nidx; f++)
+                  { diag = hits[f].diag >> Binshift;
+                    score[diag] = lastp[diag] = 0;
+                  }
+              }
+
+            //  Launch an alignment from each seed not already covered by an alignment found
+            //    from an earlier one, in the order collected or, if CHAIN_SEEDS, chain by chain
+
+            if (CHAIN_SEEDS && slist->nseed > 0)
+              Chain_Seeds(slist);
+
+            for (k = 0; k < slist->nseed; k++)
+              { Seed *sd;
+
+                if (CHAIN_SEEDS)
+                  sd = slist->seed + (slist->order[k] & SEED_MASK);
+                else
+                  sd = slist->seed + k;
+                apos = sd->apos;
+                bpos = sd->bpos;
+                diag = sd->diag;
+                if (CHAIN_SEEDS ? sd->cover : apos <= lasta[diag])
+                  continue;
+
+                if (setaln)
+                  { setaln = 0;
+                    align->aseq = aseq + aread[ar].boff;
+                    align->bseq = bseq + bread[br].boff;
+                    if (bc)
+                      { CopyAndComp(bcomp,align->bseq,blen);
+                        align->bseq = bcomp;
                       }
+                    align->alen = alen;
+                    align->blen = blen;
+                    align->flags = ovla->flags = ovlb->flags = bc;
+                    ovlb->bread = ovla->aread = ar + afirst;
+                    ovlb->aread = ovla->bread = br + bfirst;
+                  }
 #ifdef TEST_GATHER
-                    else
-                      printf("\n                    ");
+                else
+                  printf("\n                    ");
 
-                    if (scorm[diag] > scorp[diag])
-                      printf("  %5d.. x %5d.. %5d (%3d)",
-                             bpos,apos,apos-bpos,score[diag]+scorm[diag]);
-                    else
-                      printf("  %5d.. x %5d.. %5d (%3d)",
-                             bpos,apos,apos-bpos,score[diag]+scorp[diag]);
-                    fflush(stdout);
+                printf("  %5d.. x %5d.. %5d (%3d)",bpos,apos,apos-bpos,sd->score);
+                fflush(stdout);
 #endif
-                    nfilt += 1;
+                nfilt += 1;
 #ifdef PROFILE
-                    if (scorm[diag] > scorp[diag])
-                      maxhit = score[diag] + scorm[diag];
-                    else
-                      maxhit = score[diag] + scorp[diag];
-                    if (maxhit > MAXHIT)
-                      maxhit = MAXHIT;
+                maxhit = sd->score;
+                if (maxhit > MAXHIT)
+                  maxhit = MAXHIT;
 #endif
 
 #ifdef DO_ALIGNMENT
-                    bpath = Local_Alignment(align,work,MR_spec,apos-bpos,apos-bpos,apos+bpos,-1,-1);
-
-                    { int low, hgh, ae;
-
-                      Diagonal_Span(apath,&low,&hgh);
-                      if (diag < low)
-                        low = diag;
-                      else if (diag > hgh)
-                        hgh = diag;
-                      ae = apath->aepos;
-                      for (diag = low; diag <= hgh; diag++)
-                        if (ae > lasta[diag])
-                          lasta[diag] = ae;
+                bpath = Local_Alignment(align,work,MR_spec,apos-bpos,apos-bpos,apos+bpos,-1,-1);
+
+                { int low, hgh, ae;
+
+                  Diagonal_Span(apath,&low,&hgh);
+                  if (diag < low)
+                    low = diag;
+                  else if (diag > hgh)
+                    hgh = diag;
+                  ae = apath->aepos;
+                  if (CHAIN_SEEDS)
+                    Cover_Seeds(slist,low,hgh,apath->abpos,ae);
+                  else
+                    for (diag = low; diag <= hgh; diag++)
+                      if (ae > lasta[diag])
+                        lasta[diag] = ae;
 #ifdef TEST_GATHER
-                      printf(" %d - %d @ %d",low,hgh,apath->aepos);
-                      fflush(stdout);
+                  printf(" %d - %d @ %d",low,hgh,apath->aepos);
+                  fflush(stdout);
 #endif
-                    }
+                }
 
-                    if ((apath->aepos-apath->abpos) + (apath->bepos-apath->bbpos) >= MINOVER)
-                      { if (novl >= Omax)
-                          { Omax = 1.2*novl + MATCH_CHUNK;
-                            amatch = Realloc(amatch,sizeof(Path)*Omax,
-                                             "Reallocating match vector");
-                            bmatch = Realloc(bmatch,sizeof(Path)*Omax,
-                                             "Reallocating match vector");
-                            if (amatch == NULL || bmatch == NULL)
-                              Clean_Exit(1);
-                          }
+                if ((apath->aepos-apath->abpos) + (apath->bepos-apath->bbpos) >= MINOVER)
+                  { if (novl >= Omax)
+                      { Omax = 1.2*novl + MATCH_CHUNK;
+                        amatch = Realloc(amatch,sizeof(Path)*Omax,
+                                         "Reallocating match vector");
+                        bmatch = Realloc(bmatch,sizeof(Path)*Omax,
+                                         "Reallocating match vector");
+                        if (amatch == NULL || bmatch == NULL)
+                          Clean_Exit(1);
+                      }
 
-                        if (tbuf->top + (apath->tlen + bpath->tlen) > tbuf->max)
-                          { tbuf->max = 1.2*(tbuf->top+(apath->tlen+bpath->tlen)) + TRACE_CHUNK;
-                            tbuf->trace = Realloc(tbuf->trace,sizeof(short)*tbuf->max,
-                                                  "Reallocating trace vector");
-                            if (tbuf->trace == NULL)
-                              Clean_Exit(1);
-                          }
+                    if (tbuf->top + (apath->tlen + bpath->tlen) > tbuf->max)
+                      { tbuf->max = 1.2*(tbuf->top+(apath->tlen+bpath->tlen)) + TRACE_CHUNK;
+                        tbuf->trace = Realloc(tbuf->trace,sizeof(short)*tbuf->max,
+                                              "Reallocating trace vector");
+                        if (tbuf->trace == NULL)
+                          Clean_Exit(1);
+                      }
 
-                        amatch[novl] = *apath;
-                        amatch[novl].trace = (void *) (tbuf->top);
-                        memmove(tbuf->trace+tbuf->top,apath->trace,sizeof(short)*apath->tlen);
-                        tbuf->top += apath->tlen;
+                    amatch[novl] = *apath;
+                    amatch[novl].trace = (void *) (tbuf->top);
+                    memmove(tbuf->trace+tbuf->top,apath->trace,sizeof(short)*apath->tlen);
+                    tbuf->top += apath->tlen;
 
-                        bmatch[novl] = *bpath;
-                        bmatch[novl].trace = (void *) (tbuf->top);
-                        memmove(tbuf->trace+tbuf->top,bpath->trace,sizeof(short)*bpath->tlen);
-                        tbuf->top += bpath->tlen;
+                    bmatch[novl] = *bpath;
+                    bmatch[novl].trace = (void *) (tbuf->top);
+                    memmove(tbuf->trace+tbuf->top,bpath->trace,sizeof(short)*bpath->tlen);
+                    tbuf->top += bpath->tlen;
 
-                        novl += 1;
+                    novl += 1;
 #ifdef PROFILE
-                        profyes[maxhit] += 1;
+                    profyes[maxhit] += 1;
 #endif
 
 #ifdef TEST_GATHER
-                        printf("  [%5d,%5d] x [%5d,%5d] = %4d",
-                               apath->abpos,apath->aepos,apath->bbpos,apath->bepos,apath->diffs);
-                        fflush(stdout);
+                    printf("  [%5d,%5d] x [%5d,%5d] = %4d",
+                           apath->abpos,apath->aepos,apath->bbpos,apath->bepos,apath->diffs);
+                    fflush(stdout);
 #endif
 #ifdef SHOW_OVERLAP
-                        printf("\n\n                    %d(%d) vs %d(%d)\n\n",
-                               ovla->aread,ovla->alen,ovla->bread,ovla->blen);
-                        Print_ACartoon(stdout,align,ALIGN_INDENT);
+                    printf("\n\n                    %d(%d) vs %d(%d)\n\n",
+                           ovla->aread,ovla->alen,ovla->bread,ovla->blen);
+                    Print_ACartoon(stdout,align,ALIGN_INDENT);
 #ifdef SHOW_ALIGNMENT
-                        Compute_Trace_ALL(align,work);
-                        printf("\n                      Diff = %d\n",align->path->diffs);
-                        Print_Alignment(stdout,align,work,
-                                        ALIGN_INDENT,ALIGN_WIDTH,ALIGN_BORDER,0,5);
+                    Compute_Trace_ALL(align,work);
+                    printf("\n                      Diff = %d\n",align->path->diffs);
+                    Print_Alignment(stdout,align,work,
+                                    ALIGN_INDENT,ALIGN_WIDTH,ALIGN_BORDER,0,5);
 #endif
 #endif // SHOW_OVERLAP
 
-                      }
-                    else
+                  }
+                else
 #ifdef TEST_GATHER
-                      printf("  No alignment %d",
-                              ((apath->aepos-apath->abpos) + (apath->bepos-apath->bbpos))/2);
-                    fflush(stdout);
+                  printf("  No alignment %d",
+                          ((apath->aepos-apath->abpos) + (apath->bepos-apath->bbpos))/2);
+                fflush(stdout);
 #else
 #ifdef PROFILE
-                      { if (ar != br)
-                          profno[maxhit] += 1;
-                      }
+                  { if (ar != br)
+                      profno[maxhit] += 1;
+                  }
 #else
-                      ;
+                  ;
 #endif
 #endif
 
 #endif // DO_ALIGNMENT
-                  }
-              }
-
-            for (f = lidx; f < nidx; f++)
-              { diag = hits[f].diag >> Binshift;
-                score[diag] = lastp[diag] = 0;
               }
 #ifdef TEST_GATHER
             printf("\n");
             fflush(stdout);
 #endif
-          }
 
-        for (f = sidx; f < nidx; f++)
-          { int d;
+            for (f = sidx; f < nidx; f++)
+              { int d;
 
-            diag = hits[f].diag >> Binshift;
-            for (d = diag; d <= maxdiag; d++)
-              if (lasta[d] == 0)
-                break;
-              else
-                lasta[d] = 0;
-            for (d = diag-1; d >= mindiag; d--)
-              if (lasta[d] == 0)
-                break;
-              else
-                lasta[d] = 0;
-          }
+                diag = hits[f].diag >> Binshift;
+                for (d = diag; d <= maxdiag; d++)
+                  if (lasta[d] == 0)
+                    break;
+                  else
+                    lasta[d] = 0;
+                for (d = diag-1; d >= mindiag; d--)
+                  if (lasta[d] == 0)
+                    break;
+                  else
+                    lasta[d] = 0;
+              }
 
          
-         { int i;
+             { int i;
 
 #ifdef TEST_CONTAIN
-           if (novl > 1)
-             printf("\n%5d vs %5d:\n",ar,br);
+               if (novl > 1)
+                 printf("\n%5d vs %5d:\n",ar,br);
 #endif
 
-           novl = Handle_Redundancies(amatch,novl,bmatch,align,work,tbuf);
-
-           if (doA)
-             { for (i = 0; i < novl; i++)
-                 { ovla->path = amatch[i];
-                   ovla->path.trace = tbuf->trace + (uint64) (ovla->path.trace);
-                   if (small)
-                     Compress_TraceTo8(ovla,1);
-                   if (Write_Overlap(ofile1,ovla,tbytes))
-                     { fprintf(stderr,"%s: Cannot write to %s too small?\n",SORT_PATH,Prog_Name);
-                       Clean_Exit(1);
+               nredun += novl;
+               novl    = Handle_Redundancies(amatch,novl,bmatch,align,work,tbuf);
+               nredun -= novl;
+
+               if (doA)
+                 { for (i = 0; i < novl; i++)
+                     { ovla->path = amatch[i];
+                       ovla->path.trace = tbuf->trace + (uint64) (ovla->path.trace);
+                       if (small)
+                         Compress_TraceTo8(ovla,1);
+                       Put_Ovl(ofile1,ovla,tbytes);
                      }
+                   ahits += novl;
                  }
-               ahits += novl;
-             }
-           if (doB)
-             { for (i = 0; i < novl; i++)
-                 { ovlb->path = bmatch[i];
-                   ovlb->path.trace = tbuf->trace + (uint64) (ovlb->path.trace);
-                   if (small)
-                     Compress_TraceTo8(ovlb,1);
-                   if (Write_Overlap(ofile2,ovlb,tbytes))
-                     { fprintf(stderr,"%s: Cannot write to %s, too small?\n",SORT_PATH,Prog_Name);
-                       Clean_Exit(1);
+               if (doB)
+                 { for (i = 0; i < novl; i++)
+                     { ovlb->path = bmatch[i];
+                       ovlb->path.trace = tbuf->trace + (uint64) (ovlb->path.trace);
+                       if (small)
+                         Compress_TraceTo8(ovlb,1);
+                       Put_Ovl(ofile2,ovlb,tbytes);
                      }
+                   bhits += novl;
                  }
-               bhits += novl;
-             }
 
-           nlas += novl;
-         }
-      }
+               nlas += novl;
+             }
+          }
+    }
 
+  free(slist->chain);
+  free(slist->order);
+  free(slist->seed);
   free(tbuf->trace);
   free(bmatch);
   free(amatch);
   free(bcomp-1);
 
-  data->nfilt = nfilt;
-  data->nlas  = nlas;
-
-  if (MR_two)
-    { rewind(ofile2);
-      fwrite(&bhits,sizeof(int64),1,ofile2);
-      fclose(ofile2);
-    }
-  else
-    ahits += bhits;
-
-  rewind(ofile1);
-  fwrite(&ahits,sizeof(int64),1,ofile1);
-  fclose(ofile1);
+  data->nfilt  += nfilt;
+  data->nlas   += nlas;
+  data->ahits  += ahits;
+  data->bhits  += bhits;
+  data->npanel += npanel;
+  data->nredun += nredun;
+  data->nchunk += nchunk;
+  data->busy   += wall_clock() - start;
 
   return (NULL);
 }
@@ -2273,23 +4606,31 @@ static char *NameBuffer(char *aname, char *bname)
   return (cat);
 }
 
-void Match_Filter(char *aname, DAZZ_DB *ablock, char *bname, DAZZ_DB *bblock,
-                  void *vasort, int alen, void *vbsort, int blen, Align_Spec *aspec)
+int Match_Filter(char *aname, DAZZ_DB *ablock, char *bname, DAZZ_DB *bblock,
+                 void *vasort, int64 alen, void *vbsort, int64 blen, Align_Spec *aspec)
 { THREAD     threads[NTHREADS];
   Merge_Arg  parmm[NTHREADS];
   Report_Arg parmr[NTHREADS];
+  Las_Output lasout[2*NTHREADS];
   char      *fname;
+  int        merged;    //  MERGED_AB | MERGED_BA for the .las files written here
 
   SeedPair *khit, *hhit;
   SeedPair *work1, *work2;
-  int64     nhits;
+  int64     nhits, mhits;
   int64     nfilt, nlas;
+  int64     ngrow;
 
-  KmerPos  *asort, *bsort;
+  void     *asort, *bsort;
   int64     atot, btot;
 
-  asort = (KmerPos *) vasort;
-  bsort = (KmerPos *) vbsort;
+  int64    *rhits;      //  If slicing, rhits[i*areads+r] = # of hits of A-read r in thread i
+  int      *slice;      //  Slice s is A-reads [slice[s],slice[s+1])
+  int       nslice;
+  int       areads;
+
+  asort = vasort;
+  bsort = vbsort;
 
   atot = ablock->totlen;
   btot = bblock->totlen;
@@ -2297,6 +4638,11 @@ void Match_Filter(char *aname, DAZZ_DB *ablock, char *bname, DAZZ_DB *bblock,
   MR_tspace = Trace_Spacing(aspec);
 
   nfilt = nlas = nhits = 0;
+  ngrow  = 0;
+  merged = 0;
+  areads = ablock->nreads;
+  rhits  = NULL;
+  slice  = NULL;
 
   if (VERBOSE)
     printf("\nComparing %s to %s\n",aname,bname);
@@ -2304,7 +4650,8 @@ void Match_Filter(char *aname, DAZZ_DB *ablock, char *bname, DAZZ_DB *bblock,
   if (alen == 0 || blen == 0)
     goto zerowork;
 
-  { int    i, j, p;
+  { int    i, j;
+    int64  p, avail;
     uint64 c;
     int    limit;
 
@@ -2314,244 +4661,363 @@ void Match_Filter(char *aname, DAZZ_DB *ablock, char *bname, DAZZ_DB *bblock,
     MG_bblock = bblock;
     MG_self   = (ablock == bblock);
 
+    if (SLICE_SIZE > 0)
+      { rhits = (int64 *) Malloc(sizeof(int64)*NTHREADS*areads,"Allocating slice counts");
+        if (rhits == NULL)
+          Clean_Exit(1);
+        for (p = ((int64) NTHREADS)*areads-1; p >= 0; p--)
+          rhits[p] = 0;
+      }
+
     parmm[0].abeg = parmm[0].bbeg = 0;
     for (i = 1; i < NTHREADS; i++)
-      { p = (int) ((((int64) alen) * i) / NTHREADS);
+      { p = (alen * i) / NTHREADS;
         if (p > 0)
-          { c = asort[p-1].code;
-            while (asort[p].code == c)
+          { c = KCODE(asort,p-1,Compact);
+            while (KCODE(asort,p,Compact) == c)
               p += 1;
           }
         parmm[i].abeg = parmm[i-1].aend = p;
-        parmm[i].bbeg = parmm[i-1].bend = find_tuple(asort[p].code,bsort,blen);
+        parmm[i].bbeg = parmm[i-1].bend = find_tuple(KCODE(asort,p,Compact),bsort,blen);
       }
     parmm[NTHREADS-1].aend = alen;
     parmm[NTHREADS-1].bend = blen;
 
     for (i = 0; i < NTHREADS; i++)
-      for (j = 0; j < MAXGRAM; j++)
-        parmm[i].hitgram[j] = 0;
+      { for (j = 0; j < MAXGRAM; j++)
+          parmm[i].hitgram[j] = 0;
+        parmm[i].limit = INT32_MAX;
+        if (rhits == NULL)
+          parmm[i].rhits = NULL;
+        else
+          parmm[i].rhits = rhits + ((int64) i)*areads;
+      }
 
-    for (i = 0; i < NTHREADS; i++)
-      pthread_create(threads+i,NULL,count_thread,parmm+i);
+    //  If both blocks have code tables and per-read counts are not needed then count the
+    //    hits from the tables, otherwise by running through the indices
 
-    for (i = 0; i < NTHREADS; i++)
-      pthread_join(threads[i],NULL);
+    if (CODE_COUNTS && ! MG_self && rhits == NULL
+                    && KMER_HEADER(asort)->ncodes > 0 && KMER_HEADER(bsort)->ncodes > 0)
+      { parmm[0].cabeg = parmm[0].cbbeg = 0;
+        for (i = 1; i < NTHREADS; i++)
+          { c = KCODE(asort,parmm[i].abeg,Compact);
+            if (parmm[i].abeg >= alen)
+              { parmm[i].cabeg = KMER_HEADER(asort)->ncodes;
+                parmm[i].cbbeg = KMER_HEADER(bsort)->ncodes;
+              }
+            else
+              { parmm[i].cabeg = find_code(c,asort);
+                parmm[i].cbbeg = find_code(c,bsort);
+              }
+            parmm[i-1].caend = parmm[i].cabeg;
+            parmm[i-1].cbend = parmm[i].cbbeg;
+          }
+        parmm[NTHREADS-1].caend = KMER_HEADER(asort)->ncodes;
+        parmm[NTHREADS-1].cbend = KMER_HEADER(bsort)->ncodes;
+
+        for (i = 0; i < NTHREADS; i++)
+          pthread_create(threads+i,NULL,codes_thread,parmm+i);
+
+        for (i = 0; i < NTHREADS; i++)
+          pthread_join(threads[i],NULL);
+      }
+    else
+      { for (i = 0; i < NTHREADS; i++)
+          pthread_create(threads+i,NULL,count_thread,parmm+i);
+
+        for (i = 0; i < NTHREADS; i++)
+          pthread_join(threads[i],NULL);
+      }
+
+    //  Under -M cap the mutual k-mer matches so that the hit vectors fit in the memory left.
+    //    When slicing (-S) the vectors hold a slice, so slices are also kept to this size and
+    //    the matches are capped only if the hits of a single A-read would not fit, in which
+    //    case the hits of each A-read are recounted without those of the capped k-mers.
 
     if (VERBOSE)
       printf("\n");
+    avail = INT64_MAX;
     if (MEM_LIMIT > 0)
       { int64 histo[MAXGRAM];
-        int64 tom, avail;
-
-        for (j = 0; j < MAXGRAM; j++)
-          histo[j] = parmm[0].hitgram[j];
-        for (i = 1; i < NTHREADS; i++)
-          for (j = 0; j < MAXGRAM; j++)
-            histo[j] += parmm[i].hitgram[j];
-
-        avail = (int64) (MEM_LIMIT - (sizeof_DB(ablock) + sizeof_DB(bblock))) / sizeof(KmerPos);
-        if (asort == bsort || avail > alen + 2*blen)
+        int64 tom, h, hmax;
+        int   r;
+
+        avail = (int64) (MEM_LIMIT - (MEM_RESERVE + sizeof_DB(ablock) + sizeof_DB(bblock)))
+                  / Ksize;
+        if (rhits != NULL)
+          avail = (avail - (asort == bsort ? alen : alen + blen)) / 2;
+        else if (asort == bsort || avail > alen + 2*blen)
           avail = (avail - alen) / 2;
         else
           avail = avail - (alen + blen);
-        avail *= (.98 * sizeof(KmerPos)) / sizeof(SeedPair);
+        avail *= (.98 * Ksize) / sizeof(SeedPair);
+
+        hmax = 0;
+        if (rhits != NULL)
+          for (r = 0; r < areads; r++)
+            { h = 0;
+              for (i = 0; i < NTHREADS; i++)
+                h += parmm[i].rhits[r];
+              if (h > hmax)
+                hmax = h;
+            }
 
-        tom = 0;
-        for (j = 0; j < MAXGRAM; j++)
-          { tom += j*histo[j];
-            if (tom > avail)
-              break;
-          }
-        limit = j;
+        if (rhits == NULL || hmax > avail)
+          { for (j = 0; j < MAXGRAM; j++)
+              histo[j] = parmm[0].hitgram[j];
+            for (i = 1; i < NTHREADS; i++)
+              for (j = 0; j < MAXGRAM; j++)
+                histo[j] += parmm[i].hitgram[j];
+
+            tom = 0;
+            for (j = 0; j < MAXGRAM; j++)
+              { tom += j*histo[j];
+                if (tom > avail)
+                  break;
+              }
+            limit = j;
 
-        if (limit <= 1)
-          { fprintf(stderr,"\nError: Insufficient ");
-            if (MEM_LIMIT == MEM_PHYSICAL)
-              fprintf(stderr," physical memory (%.1fGb), reduce block size\n",
-                             (1.*MEM_LIMIT)/0x40000000ll);
-            else
-              { fprintf(stderr," memory allocation (%.1fGb),",(1.*MEM_LIMIT)/0x40000000ll);
-                fprintf(stderr," reduce block size or increase allocation\n");
+            if (limit <= 1)
+              { fprintf(stderr,"\nError: Insufficient ");
+                if (MEM_LIMIT == MEM_PHYSICAL)
+                  fprintf(stderr," physical memory (%.1fGb), reduce block size\n",
+                                 (1.*MEM_LIMIT)/0x40000000ll);
+                else
+                  { fprintf(stderr," memory allocation (%.1fGb),",(1.*MEM_LIMIT)/0x40000000ll);
+                    fprintf(stderr," reduce block size or increase allocation\n");
+                  }
+                fflush(stderr);
+                Clean_Exit(1);
               }
-            fflush(stderr);
-            Clean_Exit(1);
-          }
-        if (limit < 30)
-          { fprintf(stderr,"\nWarning: Sensitivity hampered by low ");
-            if (MEM_LIMIT == MEM_PHYSICAL)
-              fprintf(stderr," physical memory (%.1fGb), reduce block size\n",
-                             (1.*MEM_LIMIT)/0x40000000ll);
-            else
-              { fprintf(stderr," memory allocation (%.1fGb),",(1.*MEM_LIMIT)/0x40000000ll);
-                fprintf(stderr," reduce block size or increase allocation\n");
+            if (limit < 30)
+              { fprintf(stderr,"\nWarning: Sensitivity hampered by low ");
+                if (MEM_LIMIT == MEM_PHYSICAL)
+                  fprintf(stderr," physical memory (%.1fGb), reduce block size\n",
+                                 (1.*MEM_LIMIT)/0x40000000ll);
+                else
+                  { fprintf(stderr," memory allocation (%.1fGb),",(1.*MEM_LIMIT)/0x40000000ll);
+                    fprintf(stderr," reduce block size or increase allocation\n");
+                  }
+                fflush(stderr);
+              }
+            if (VERBOSE)
+              { printf("   Capping mutual k-mer matches over %d (effectively -t%d)\n",
+                       limit,(int) sqrt(1.*limit));
+                fflush(stdout);
               }
-            fflush(stderr);
-          }
-        if (VERBOSE)
-          { printf("   Capping mutual k-mer matches over %d (effectively -t%d)\n",
-                   limit,(int) sqrt(1.*limit));
-            fflush(stdout);
-          }
 
-        for (i = 0; i < NTHREADS; i++)
-          { parmm[i].nhits = 0;
-            for (j = 1; j < limit; j++)
-              parmm[i].nhits += j * parmm[i].hitgram[j];
-            parmm[i].limit = limit;
+            for (i = 0; i < NTHREADS; i++)
+              parmm[i].limit = limit;
+
+            if (rhits != NULL)
+              { for (p = ((int64) NTHREADS)*areads-1; p >= 0; p--)
+                  rhits[p] = 0;
+                for (i = 0; i < NTHREADS; i++)
+                  { for (j = 0; j < MAXGRAM; j++)
+                      parmm[i].hitgram[j] = 0;
+                    pthread_create(threads+i,NULL,count_thread,parmm+i);
+                  }
+                for (i = 0; i < NTHREADS; i++)
+                  pthread_join(threads[i],NULL);
+              }
+
+            for (i = 0; i < NTHREADS; i++)
+              { parmm[i].nhits = 0;
+                for (j = 1; j < limit; j++)
+                  parmm[i].nhits += j * parmm[i].hitgram[j];
+              }
           }
       }
-    else
-      for (i = 0; i < NTHREADS; i++)
-        parmm[i].limit = INT32_MAX;
 
     nhits = parmm[0].nhits;
     for (i = 1; i < NTHREADS; i++)
       parmm[i].nhits = nhits += parmm[i].nhits;
 
+    //  If slicing, cut the A-reads into consecutive ranges with at most SLICE_SIZE million
+    //    hits each (save for a range of a single read that has more)
+
+    if (rhits != NULL)
+      { int64 slim, shits, h;
+        int   r, mslice;
+
+        slim   = SLICE_SIZE * 1000000ll;
+        if (slim > avail && avail > 0)
+          slim = avail;
+        mslice = nhits/slim + 2;
+        slice  = (int *) Malloc(sizeof(int)*(mslice+1),"Allocating slices");
+        if (slice == NULL)
+          Clean_Exit(1);
+
+        nslice = 0;
+        mhits  = 0;
+        shits  = 0;
+        slice[0] = 0;
+        for (r = 0; r < areads; r++)
+          { h = 0;
+            for (i = 0; i < NTHREADS; i++)
+              h += parmm[i].rhits[r];
+            if (shits + h > slim && r > slice[nslice])
+              { if (nslice+1 >= mslice)
+                  { mslice = 1.2*mslice + 10;
+                    slice  = (int *) Realloc(slice,sizeof(int)*(mslice+1),"Growing slices");
+                    if (slice == NULL)
+                      Clean_Exit(1);
+                  }
+                if (shits > mhits)
+                  mhits = shits;
+                slice[++nslice] = r;
+                shits = 0;
+              }
+            shits += h;
+          }
+        if (shits > mhits)
+          mhits = shits;
+        slice[++nslice] = areads;
+      }
+    else
+      { nslice = 1;
+        mhits  = nhits;
+      }
+
     if (VERBOSE)
       { printf("   Hit count = ");
         Print_Number(nhits,0,stdout);
-	if (asort == bsort || nhits*sizeof(SeedPair) >= blen*sizeof(KmerPos))
+        if (nslice > 1)
+          { printf("\n   Processing %s in %d slices of at most ",aname,nslice);
+            Print_Number(mhits,0,stdout);
+            printf(" hits");
+            printf("\n   Highwater of %.2fGb space\n",
+                   (1. * ((alen + blen)*Ksize + 2*mhits*sizeof(SeedPair)) / 0x40000000ll));
+          }
+	else if (asort == bsort || nhits*((int64) sizeof(SeedPair)) >= blen*Ksize)
           printf("\n   Highwater of %.2fGb space\n",
-                 (1. * (alen*sizeof(KmerPos) + 2*nhits*sizeof(SeedPair)) / 0x40000000ll));
+                 (1. * (alen*Ksize + 2*nhits*sizeof(SeedPair)) / 0x40000000ll));
         else
           printf("\n   Highwater of %.2fGb space\n",
-                 (1. * ((alen + blen)*sizeof(KmerPos) + nhits*sizeof(SeedPair)) / 0x40000000ll));
+                 (1. * ((alen + blen)*Ksize + nhits*sizeof(SeedPair)) / 0x40000000ll));
         fflush(stdout);
       }
 
     if (nhits == 0)
       goto zerowork;
 
-    if (asort == bsort)
-      hhit = work1 = (SeedPair *) Malloc(sizeof(SeedPair)*(nhits+1),
+    if (asort == bsort || KMER_HEADER(bsort)->msize > 0 || nslice > 1)
+      hhit = work1 = (SeedPair *) Malloc(sizeof(SeedPair)*(mhits+1),
                                          "Allocating daligner hit vectors");
     else
-      { if (nhits*sizeof(SeedPair) >= blen*sizeof(KmerPos))
-          bsort = (KmerPos *) Realloc(bsort,sizeof(SeedPair)*(nhits+1),
-                                       "Reallocating daligner sort vectors");
+      { if (nhits*((int64) sizeof(SeedPair)) >= blen*Ksize)
+          { Kmer_Header *h;
+
+            h = (Kmer_Header *) Realloc(KMER_HEADER(bsort),
+                                        sizeof(Kmer_Header) + sizeof(SeedPair)*(nhits+1),
+                                        "Reallocating daligner sort vectors");
+            if (h == NULL)
+              Clean_Exit(1);
+            bsort = (void *) (h+1);
+          }
         hhit = work1 = (SeedPair *) bsort;
       }
-    khit = work2 = (SeedPair *) Malloc(sizeof(SeedPair)*(nhits+1),
+    khit = work2 = (SeedPair *) Malloc(sizeof(SeedPair)*(mhits+1),
                                         "Allocating daligner hit vectors");
-    if (hhit == NULL || khit == NULL || bsort == NULL)
+    if (hhit == NULL || khit == NULL)
       Clean_Exit(1);
 
     MG_blist = bsort;
-    MG_hits  = khit;
-
-    for (i = NTHREADS-1; i > 0; i--)
-      parmm[i].nhits = parmm[i-1].nhits;
-    parmm[0].nhits = 0;
-
-    for (i = 0; i < NTHREADS; i++)
-      pthread_create(threads+i,NULL,merge_thread,parmm+i);
-
-    for (i = 0; i < NTHREADS; i++)
-      pthread_join(threads[i],NULL);
-
-#ifdef TEST_PAIRS
-    printf("\nSETUP SORT:\n");
-    for (i = 0; i < HOW_MANY && i < nhits; i++)
-      printf(" %6d / %6d / %5d / %5d\n",khit[i].aread,khit[i].bread,khit[i].apos,khit[i].diag);
-#endif
   }
 
-  { int i, j;
-    int pairsort[13];
-    int areads = ablock->nreads-1;
-    int breads = bblock->nreads-1;
-    int maxlen = ablock->maxlen;
-    int abits, bbits, pbits;
-
-    abits = 1;
-    while (areads > 0)
-      { areads >>= 1;
-        abits   += 1;
-      }
+  { int  max_diag  = ((ablock->maxlen >> Binshift) - ((-bblock->maxlen) >> Binshift)) + 1;
+    int   *space;
+    int    pairsort[13];
+    int    i, j, s;
+    double rwall;       //  Elapsed time of the report phases
+
+    //  Determine the radix order for sorting the seed pairs
+
+    { int ar = ablock->nreads-1;
+      int br = bblock->nreads-1;
+      int ml = ablock->maxlen;
+      int abits, bbits, pbits;
+
+      abits = 1;
+      while (ar > 0)
+        { ar    >>= 1;
+          abits  += 1;
+        }
 
-    bbits = 0;
-    while (breads > 0)
-      { breads >>= 1;
-        bbits   += 1;
-      }
+      bbits = 0;
+      while (br > 0)
+        { br    >>= 1;
+          bbits  += 1;
+        }
 
-    pbits = 1;
-    while (maxlen > 0)
-      { maxlen >>= 1;
-        pbits   += 1;
-      }
+      pbits = 1;
+      while (ml > 0)
+        { ml    >>= 1;
+          pbits  += 1;
+        }
 
 #if __ORDER_LITTLE_ENDIAN__ == __BYTE_ORDER__
-    for (i = 0; i <= (pbits-1)/8; i++)
-      pairsort[i] = 8+i;
-    j = i;
-    for (i = 0; i <= (bbits-1)/8; i++)
-      pairsort[j+i] = 4+i;
-    j += i;
-    for (i = 0; i <= (abits-1)/8; i++)
-      pairsort[j+i] = i;
+      for (i = 0; i <= (pbits-1)/8; i++)
+        pairsort[i] = 8+i;
+      j = i;
+      for (i = 0; i <= (bbits-1)/8; i++)
+        pairsort[j+i] = 4+i;
+      j += i;
+      for (i = 0; i <= (abits-1)/8; i++)
+        pairsort[j+i] = i;
 #else
-    for (i = 0; i <= (pbits-1)/8; i++)
-      pairsort[i] = 11+i;
-    j = i;
-    for (i = 0; i <= (bbits-1)/8; i++)
-      pairsort[j+i] = 7-i;
-    j += i;
-    for (i = 0; i <= (abits-1)/8; i++)
-      pairsort[j+i] = 3-i;
-#endif
-    pairsort[j+i] = -1;
-
-    khit = (SeedPair *) LSD_Sort(nhits,khit,hhit,16,16,pairsort);
-
-    khit[nhits].aread = 0x7fffffff;
-    khit[nhits].bread = 0x7fffffff;
-    khit[nhits].apos  = 0x7fffffff;
-    khit[nhits].diag  = 0x7fffffff;
-  }
-
-#ifdef TEST_CSORT
-  { int   i;
-
-    printf("\nCROSS SORT %lld:\n",nhits);
-    for (i = 0; i < HOW_MANY && i <= nhits; i++)
-      printf(" %6d / %6d / %5d / %5d\n",khit[i].aread,khit[i].bread,khit[i].apos,khit[i].diag);
-  }
+      for (i = 0; i <= (pbits-1)/8; i++)
+        pairsort[i] = 11+i;
+      j = i;
+      for (i = 0; i <= (bbits-1)/8; i++)
+        pairsort[j+i] = 7-i;
+      j += i;
+      for (i = 0; i <= (abits-1)/8; i++)
+        pairsort[j+i] = 3-i;
 #endif
+      pairsort[j+i] = -1;
+    }
 
-  { int  max_diag  = ((ablock->maxlen >> Binshift) - ((-bblock->maxlen) >> Binshift)) + 1;
-    int *space;
-    int  i;
+    //  Set up the report threads and their output files
 
     MR_ablock = ablock;
     MR_bblock = bblock;
-    MR_hits   = khit;
     MR_two    = ! MG_self && SYMMETRIC;
     MR_spec   = aspec;
 
-    { int      p, r;
-
-      parmr[0].beg = 0;
-      for (i = 1; i < NTHREADS; i++)
-        { p = (nhits * i) / NTHREADS;
-          if (p > 0)
-            { r = khit[p-1].bread;
-              while (khit[p].bread == r)
-                p += 1;
-            }
-          parmr[i].beg = parmr[i-1].end = p;
-        }
-      parmr[NTHREADS-1].end = nhits;
-    }
+    if (PANEL_LEN > 0)
+      MR_panel = PANEL_LEN;
+    else
+      { MR_panel = ablock->maxlen / PANEL_COUNT;
+        if (MR_panel < PANEL_SIZE)
+          MR_panel = PANEL_SIZE;
+      }
+    MR_povlp = MR_panel / PANEL_OVERLAP;
 
     space = (int *) Malloc(NTHREADS*3*max_diag*sizeof(int),"Allocating space for report thread");
-    if (space == NULL)
+    rwall     = 0.;
+    MR_nchunk = NTHREADS*REPORT_CHUNKS;
+    MR_chunk  = (int64 *) Malloc(sizeof(int64)*(MR_nchunk+1),"Allocating report chunks");
+    if (space == NULL || MR_chunk == NULL)
       Clean_Exit(1);
 
     fname = NameBuffer(aname,bname);
 
+    //  The in-memory outputs may use what the -M limit leaves after the blocks, indices,
+    //    hit vectors, and diagonal scores
+
+    MR_used = 0;
+    if (MEM_LIMIT == 0)
+      MR_budget = -1;
+    else
+      { MR_budget = (int64) (MEM_LIMIT - (MEM_RESERVE + sizeof_DB(ablock) + sizeof_DB(bblock)))
+                  - ((asort == bsort ? alen : alen + blen)*Ksize
+                       + 2*(mhits+1)*((int64) sizeof(SeedPair))
+                       + NTHREADS*3*max_diag*((int64) sizeof(int)));
+        if (MR_budget < 0)
+          MR_budget = 0;
+      }
+
     for (i = 0; i < 3*max_diag*NTHREADS; i++)
       space[i] = 0;
     for (i = 0; i < NTHREADS; i++)
@@ -2561,44 +5027,208 @@ void Match_Filter(char *aname, DAZZ_DB *ablock, char *bname, DAZZ_DB *bblock,
           parmr[i].score = parmr[i-1].lasta + max_diag;
         parmr[i].lastp = parmr[i].score + max_diag;
         parmr[i].lasta = parmr[i].lastp + max_diag;
-        parmr[i].work  = New_Work_Data();
+        parmr[i].work  = New_Work_Data_Sized(ablock->maxlen > bblock->maxlen ?
+                                               ablock->maxlen : bblock->maxlen, aspec);
+        parmr[i].ahits = parmr[i].bhits = 0;
+        parmr[i].nfilt = parmr[i].nlas  = 0;
+        parmr[i].npanel = parmr[i].nredun = 0;
+        parmr[i].nchunk = 0;
+        parmr[i].busy   = 0.;
 
         sprintf(fname,"%s/%s.%s.N%d.las",SORT_PATH,aname,bname,i+1);
-        parmr[i].ofile1 = Fopen(fname,"w");
-        if (parmr[i].ofile1 == NULL)
-          Clean_Exit(1);
+        parmr[i].ofile1 = lasout + 2*i;
+        Open_Las(parmr[i].ofile1,fname,MEMORY_SORT);
 
         if (MG_self)
           parmr[i].ofile2 = parmr[i].ofile1;
         else if (SYMMETRIC)
           { sprintf(fname,"%s/%s.%s.N%d.las",SORT_PATH,bname,aname,i+1);
-            parmr[i].ofile2 = Fopen(fname,"w");
-            if (parmr[i].ofile2 == NULL)
-              Clean_Exit(1);
+            parmr[i].ofile2 = lasout + (2*i+1);
+            Open_Las(parmr[i].ofile2,fname,MEMORY_SORT);
           }
       }
 
+    //  For each slice: merge, sort, and report its hits
+
+    for (s = 0; s < nslice; s++)
+      { int64 shits;
+
+        khit = work2;
+        hhit = work1;
+
+        if (rhits != NULL)
+          { int64 x;
+            int   r;
+
+            shits = 0;
+            for (i = 0; i < NTHREADS; i++)
+              { x = 0;
+                for (r = slice[s]; r < slice[s+1]; r++)
+                  x += parmm[i].rhits[r];
+                parmm[i].nhits = shits;
+                parmm[i].rlo   = slice[s];
+                parmm[i].rhi   = slice[s+1];
+                shits += x;
+              }
+            if (VERBOSE && nslice > 1)
+              { printf("   Slice %d: reads %d-%d, ",s+1,slice[s],slice[s+1]-1);
+                Print_Number(shits,0,stdout);
+                printf(" hits\n");
+                fflush(stdout);
+              }
+            if (shits == 0)
+              continue;
+          }
+        else
+          { shits = nhits;
+            for (i = NTHREADS-1; i > 0; i--)
+              parmm[i].nhits = parmm[i-1].nhits;
+            parmm[0].nhits = 0;
+          }
+
+        MG_hits = khit;
+
+        for (i = 0; i < NTHREADS; i++)
+          pthread_create(threads+i,NULL,merge_thread,parmm+i);
+
+        for (i = 0; i < NTHREADS; i++)
+          pthread_join(threads[i],NULL);
+
+#ifdef TEST_PAIRS
+        printf("\nSETUP SORT:\n");
+        for (i = 0; i < HOW_MANY && i < shits; i++)
+          printf(" %6d / %6d / %5d / %5d\n",khit[i].aread,khit[i].bread,khit[i].apos,khit[i].diag);
+#endif
+
+        khit = (SeedPair *) LSD_Sort_Threads(shits,khit,hhit,16,16,pairsort,NTHREADS,VERBOSE);
+
+        khit[shits].aread = 0x7fffffff;
+        khit[shits].bread = 0x7fffffff;
+        khit[shits].apos  = 0x7fffffff;
+        khit[shits].diag  = 0x7fffffff;
+
+#ifdef TEST_CSORT
+        printf("\nCROSS SORT %lld:\n",shits);
+        for (i = 0; i < HOW_MANY && i <= shits; i++)
+          printf(" %6d / %6d / %5d / %5d\n",khit[i].aread,khit[i].bread,khit[i].apos,khit[i].diag);
+#endif
+
+        MR_hits = khit;
+
+        { int64 p;
+          int   r, c;
+
+          MR_chunk[0] = 0;
+          for (c = 1; c < MR_nchunk; c++)
+            { p = (shits * c) / MR_nchunk;
+              if (p < MR_chunk[c-1])
+                p = MR_chunk[c-1];
+              else if (p > 0)
+                { r = khit[p-1].bread;
+                  while (khit[p].bread == r)
+                    p += 1;
+                }
+              MR_chunk[c] = p;
+            }
+          MR_chunk[MR_nchunk] = shits;
+          MR_next = 0;
+        }
+
+        { double start;
+
+          start = wall_clock();
+
 #ifdef NOTHREAD
 
-    for (i = 0; i < NTHREADS; i++)
-      report_thread(parmr+i);
+          for (i = 0; i < NTHREADS; i++)
+            report_thread(parmr+i);
 
 #else
 
-    for (i = 0; i < NTHREADS; i++)
-      pthread_create(threads+i,NULL,report_thread,parmr+i);
+          for (i = 0; i < NTHREADS; i++)
+            pthread_create(threads+i,NULL,report_thread,parmr+i);
 
-    for (i = 0; i < NTHREADS; i++)
-      pthread_join(threads[i],NULL);
+          for (i = 0; i < NTHREADS; i++)
+            pthread_join(threads[i],NULL);
 
 #endif
 
-    for (i = 0; i < NTHREADS; i++)
-      { nfilt += parmr[i].nfilt;
-        nlas  += parmr[i].nlas;
-        Free_Work_Data(parmr[i].work);
+          rwall += wall_clock() - start;
+        }
+      }
+
+    //  Set the overlap counts of the output files and close them.  If all the outputs
+    //    for a .las file are still in memory then sort and merge them into it, otherwise
+    //    spill them all so that LAsort and LAmerge can do so.
+
+    { int     spill1, spill2;
+      Las_Run run[NTHREADS];
+
+      spill1 = spill2 = 0;
+      for (i = 0; i < NTHREADS; i++)
+        { spill1 |= ! parmr[i].ofile1->memory;
+          if (MR_two)
+            spill2 |= ! parmr[i].ofile2->memory;
+        }
+
+      for (i = 0; i < NTHREADS; i++)
+        { if (MR_two)
+            Close_Las(parmr[i].ofile2,parmr[i].bhits,spill2);
+          else
+            parmr[i].ahits += parmr[i].bhits;
+          Close_Las(parmr[i].ofile1,parmr[i].ahits,spill1);
+
+          nfilt += parmr[i].nfilt;
+          nlas  += parmr[i].nlas;
+          ngrow += Work_Data_Enlargements(parmr[i].work);
+          Free_Work_Data(parmr[i].work);
+        }
+      free(MR_chunk);
+      free(space);
+
+      if (MEMORY_SORT)
+        { if (VERBOSE && (spill1 || spill2))
+            printf("\n   Output exceeds memory limit, sorting and merging via %s\n",SORT_PATH);
+
+          if ( ! spill1)
+            { for (i = 0; i < NTHREADS; i++)
+                run[i].out = parmr[i].ofile1;
+              sprintf(fname,"%s.%s.las",aname,bname);
+              Merge_Las(run,NTHREADS,fname);
+              merged |= MERGED_AB;
+            }
+          if (MR_two && ! spill2)
+            { for (i = 0; i < NTHREADS; i++)
+                run[i].out = parmr[i].ofile2;
+              sprintf(fname,"%s.%s.las",bname,aname);
+              Merge_Las(run,NTHREADS,fname);
+              merged |= MERGED_BA;
+            }
+        }
+    }
+
+    if (VERBOSE)
+      { int64 npanel, nredun;
+
+        printf("\n   Report threads (busy / idle seconds, chunks):\n");
+        npanel = nredun = 0;
+        for (i = 0; i < NTHREADS; i++)
+          { printf("     %3d: %9.3f / %9.3f %6lld\n",i+1,parmr[i].busy,rwall-parmr[i].busy,
+                                                       parmr[i].nchunk);
+            npanel += parmr[i].npanel;
+            nredun += parmr[i].nredun;
+          }
+        printf("\n   Panels of %d bp overlapping by %d: ",MR_panel,MR_povlp);
+        Print_Number(npanel,0,stdout);
+        printf(" scored, %.2f alignments launched per panel,\n",
+               npanel > 0 ? (1.*nfilt)/npanel : 0.);
+        printf("     ");
+        Print_Number(nredun,0,stdout);
+        printf(" removed as redundant, alignment work space enlarged ");
+        Print_Number(ngrow,0,stdout);
+        printf(" times\n");
+        fflush(stdout);
       }
-    free(space);
 
 #ifdef PROFILE
     { int64 nyes, nno;
@@ -2627,31 +5257,59 @@ void Match_Filter(char *aname, DAZZ_DB *ablock, char *bname, DAZZ_DB *bblock,
 #endif
   }
 
+  free(slice);
+  free(rhits);
   free(work2);
-  free(work1);
+  if ((void *) work1 == (void *) bsort)
+    Free_Kmers(bsort);
+  else
+    { free(work1);
+      if (asort != bsort)
+        Free_Kmers(bsort);
+    }
   goto epilogue;
 
 zerowork:
   { FILE *ofile;
     int   i;
 
+    free(slice);
+    free(rhits);
+    if (asort != bsort)
+      Free_Kmers(bsort);
+
     fname = NameBuffer(aname,bname);
 
     nhits  = 0;
-    for (i = 0; i < NTHREADS; i++)
-      { sprintf(fname,"%s/%s.%s.N%d.las",SORT_PATH,aname,bname,i+1);
-        ofile = Fopen(fname,"w");
-        fwrite(&nhits,sizeof(int64),1,ofile);
-        fwrite(&MR_tspace,sizeof(int),1,ofile);
-        fclose(ofile);
-        if (! MG_self && SYMMETRIC)
-          { sprintf(fname,"%s/%s.%s.N%d.las",SORT_PATH,bname,aname,i+1);
-            ofile = Fopen(fname,"w");
-            fwrite(&nhits,sizeof(int64),1,ofile);
-            fwrite(&MR_tspace,sizeof(int),1,ofile);
-            fclose(ofile);
+    if (MEMORY_SORT)
+      { Las_Output out;
+
+        sprintf(fname,"%s.%s.las",aname,bname);
+        Open_Las(&out,fname,0);
+        Close_Las(&out,0,0);
+        merged |= MERGED_AB;
+        if (ablock != bblock && SYMMETRIC)
+          { sprintf(fname,"%s.%s.las",bname,aname);
+            Open_Las(&out,fname,0);
+            Close_Las(&out,0,0);
+            merged |= MERGED_BA;
           }
       }
+    else
+      for (i = 0; i < NTHREADS; i++)
+        { sprintf(fname,"%s/%s.%s.N%d.las",SORT_PATH,aname,bname,i+1);
+          ofile = Fopen(fname,"w");
+          fwrite(&nhits,sizeof(int64),1,ofile);
+          fwrite(&MR_tspace,sizeof(int),1,ofile);
+          fclose(ofile);
+          if (! MG_self && SYMMETRIC)
+            { sprintf(fname,"%s/%s.%s.N%d.las",SORT_PATH,bname,aname,i+1);
+              ofile = Fopen(fname,"w");
+              fwrite(&nhits,sizeof(int64),1,ofile);
+              fwrite(&MR_tspace,sizeof(int),1,ofile);
+              fclose(ofile);
+            }
+        }
   }
 
 epilogue:
@@ -2674,4 +5332,6 @@ epilogue:
       printf(" confirmed hits (%e of matrix)\n",(1.*nlas/atot)/btot);
       fflush(stdout);
     }
+
+  return (merged);
 }
@@ -20,17 +20,57 @@ extern int    HGAP_MIN;     //  HGap minimum (-H)
 extern int    SYMMETRIC;    //  output both A vs B and B vs A? ( ! -A)
 extern int    IDENTITY;     //  compare reads against themselves?  (-I)
 extern int    BRIDGE;       //  bridge consecutive, chainable alignments  (-B)
+extern int    ONE_PASS;     //  build k-mer indices in one pass over the reads (-O)
+extern int    SUBSAMPLE;    //  sample rather than drop frequent k-mers (-R)
+extern int    CODE_COUNTS;  //  keep a table of the distinct codes of an index and their counts (-K)
+extern int    CHAIN_SEEDS;  //  launch alignments from chains of seeds, best first (-c)
+extern int    MAP_ORDER;    //  sort .las by A-read,A-position pairs (-a)
+extern int    MEMORY_SORT;  //  sort and merge the .las output in memory (-L)
 extern char  *SORT_PATH;    //  where to place temporary files (-P)
+extern int    DIRECT_IO;    //  write .las files in SORT_PATH with O_DIRECT (-D)
 
 extern uint64 MEM_LIMIT;    //  memory limit (-M)
 extern uint64 MEM_PHYSICAL;
+extern uint64 MEM_RESERVE;  //  part of MEM_LIMIT held by a block being fetched (-F)
+extern int    SLICE_SIZE;   //  process A block in slices of this many million hits (-S)
+extern int    PANEL_LEN;    //  score hits of long A-reads in panels of this size (-p), 0 => auto
 
-void Set_Filter_Params(int kmer, int mod, int binshift, int suppress, int hitmin, int nthreads); 
+void Set_Filter_Params(int kmer, int mod, int window, int binshift, int suppress, int budget,
+                       int hitmin, int nthreads);
 
-void *Sort_Kmers(DAZZ_DB *block, int *len);
+  //  Let Sort_Kmers use the AVX2 k-mer code if the CPU has it (the default), or not (tuple_test)
 
-void Match_Filter(char *aname, DAZZ_DB *ablock, char *bname, DAZZ_DB *bblock,
-                  void *atable, int alen, void *btable, int blen, Align_Spec *asettings);
+void Set_Filter_AVX2(int avx2);
+
+  //  Reset the # of threads Match_Filter uses, e.g. to leave some to a concurrent Sort_Kmers
+
+void Set_Filter_Threads(int nthreads);
+
+  //  Build the index of block with nthreads threads, reporting on it if verbose is set
+
+void *Sort_Kmers(DAZZ_DB *block, int64 *len, int nthreads, int verbose);
+void  Free_Kmers(void *index);
+
+  //  An estimate of the peak memory used in building an index of len k-mers
+
+int64 Kmers_Space(int64 len);
+
+  //  Cache an index in file iname along with a stamp that identifies the state of the block
+  //    it was built from, and load such a file if it matches block, stamp, and the current
+  //    filter parameters (NULL is returned otherwise).
+
+void  Save_Kmers(char *iname, void *index, uint64 stamp, int verbose);
+void *Load_Kmers(char *iname, DAZZ_DB *block, uint64 stamp, int64 *len, int verbose);
+
+  //  Match_Filter consumes btable (unless it is atable), i.e. it is freed on return.  It
+  //    returns which of aname.bname.las and bname.aname.las it has written itself (if
+  //    MEMORY_SORT), the sorted overlaps for any other being left in SORT_PATH.
+
+#define MERGED_AB  0x1
+#define MERGED_BA  0x2
+
+int Match_Filter(char *aname, DAZZ_DB *ablock, char *bname, DAZZ_DB *bblock,
+                 void *atable, int64 alen, void *btable, int64 blen, Align_Spec *asettings);
 
 void Clean_Exit(int val);
 
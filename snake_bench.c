@@ -0,0 +1,128 @@
+/*******************************************************************************************
+ *
+ *  Time Local_Alignment on a pair of synthetic reads at a range of error rates, as a
+ *    microbenchmark of the snake extension of the alignment waves.  For each rate a random
+ *    read of BENCH_LEN bases is mutated with equal parts substitutions, insertions, and
+ *    deletions, and the pair is aligned repeatedly with a spec whose ave_corr is 1 - 2*rate.
+ *    The time per alignment is reported along with the alignment found, so that runs of
+ *    differently built versions of align.c can be compared (see the bench target of the
+ *    makefiles, which builds it with the SIMD snake always on and off).  An optional
+ *    argument gives the # of alignments per rate (default 1000).
+ *
+ ********************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "DB.h"
+#include "align.h"
+
+#define BENCH_LEN  20000   //  Length of the random read
+
+static double Error_Rates[] = { .05, .08, .10, .12, .15, .20 };
+
+#define NRATES  ((int) (sizeof(Error_Rates)/sizeof(double)))
+
+  //  Return a copy of a[0..n-1] with error rate err, its length in *m, bracketed by 4's
+
+static char *Mutate(char *a, int n, double err, int *m)
+{ char  *b;
+  double r;
+  int    i, j;
+
+  b = (char *) Malloc(2*n+2,"Allocating mutated read");
+  if (b == NULL)
+    exit (1);
+
+  j = 0;
+  b[j++] = 4;
+  for (i = 0; i < n; i++)
+    { r = drand48();
+      if (r < err/3)                             //  deletion
+        continue;
+      if (r < 2*err/3)                           //  insertion
+        { b[j++] = a[i];
+          b[j++] = lrand48() & 0x3;
+        }
+      else if (r < err)                          //  substitution
+        b[j++] = (a[i] + 1 + lrand48() % 3) & 0x3;
+      else
+        b[j++] = a[i];
+    }
+  b[j] = 4;
+  *m = j-1;
+  return (b+1);
+}
+
+int main(int argc, char *argv[])
+{ float      freq[4] = { .25, .25, .25, .25 };
+  Align_Spec *spec;
+  Work_Data  *work;
+  Alignment   _align, *align = &_align;
+  Path        _path, *path = &_path;
+  char       *a, *b;
+  int         blen, reps;
+  int         i, t, r;
+
+  { char *p;
+
+    p = strrchr(argv[0],'/');
+    Prog_Name = Strdup(p == NULL ? argv[0] : p+1,"");
+  }
+
+  if (argc > 1)
+    reps = atoi(argv[1]);
+  else
+    reps = 1000;
+
+  srand48(1);
+
+  a = (char *) Malloc(BENCH_LEN+2,"Allocating read");
+  if (a == NULL)
+    exit (1);
+  *a++ = 4;
+  for (i = 0; i < BENCH_LEN; i++)
+    a[i] = lrand48() & 0x3;
+  a[BENCH_LEN] = 4;
+
+  work = New_Work_Data();
+  if (work == NULL)
+    exit (1);
+
+  for (t = 0; t < NRATES; t++)
+    { struct timespec beg, end;
+      double          usec;
+
+      b    = Mutate(a,BENCH_LEN,Error_Rates[t],&blen);
+      spec = New_Align_Spec(1.-2.*Error_Rates[t],100,freq,1);
+      if (spec == NULL)
+        exit (1);
+
+      clock_gettime(CLOCK_MONOTONIC,&beg);
+      for (r = 0; r < reps; r++)
+        { align->path  = path;
+          align->flags = 0;
+          align->aseq  = a;
+          align->bseq  = b;
+          align->alen  = BENCH_LEN;
+          align->blen  = blen;
+          Local_Alignment(align,work,spec,0,0,0,-1,-1);
+        }
+      clock_gettime(CLOCK_MONOTONIC,&end);
+
+      usec = ((end.tv_sec - beg.tv_sec)*1e9 + (end.tv_nsec - beg.tv_nsec)) / (1e3*reps);
+      printf("%s: %2.0f%% error: %8.1f us/alignment, [%d,%d] x [%d,%d] with %d diffs\n",
+             Prog_Name,100.*Error_Rates[t],usec,path->abpos,path->aepos,
+             path->bbpos,path->bepos,path->diffs);
+      fflush(stdout);
+
+      Free_Align_Spec(spec);
+      free(b-1);
+    }
+
+  Free_Work_Data(work);
+  free(a-1);
+  exit (0);
+}
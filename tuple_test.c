@@ -0,0 +1,204 @@
+/*******************************************************************************************
+ *
+ *  Check that the AVX2 and scalar k-mer extraction of Sort_Kmers give identical indices:
+ *    random blocks of reads are generated in memory, indexed with each code for a range of
+ *    k-mer sizes, modimizer thresholds, and thread counts, and the two indices compared
+ *    byte for byte as written by Save_Kmers, for both the two-pass and the one-pass (-O)
+ *    builds.  Exits with status 1 if any pair differs.  An optional argument seeds the
+ *    random number generator (default 1).
+ *
+ ********************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "DB.h"
+#include "lsd.sort.h"
+#include "filter.h"
+
+int     VERBOSE;   //   Globally visible to filter.c
+int     MINOVER;
+int     HGAP_MIN;
+int     SYMMETRIC;
+int     IDENTITY;
+int     BRIDGE;
+int     ONE_PASS;
+int     SUBSAMPLE;
+int     SLICE_SIZE;
+int     PANEL_LEN;
+int     CHAIN_SEEDS;
+int     DIRECT_IO;
+int     MEMORY_SORT;
+int     MAP_ORDER;
+int     CODE_COUNTS;
+char   *SORT_PATH;
+
+uint64  MEM_LIMIT;
+uint64  MEM_PHYSICAL;
+uint64  MEM_RESERVE;
+
+void Clean_Exit(int val)
+{ exit (val); }
+
+#define NBLOCKS  2       //  # of random blocks
+#define MAXREAD  3000    //  Reads are of length 1..MAXREAD
+
+static int Kmer_Sizes[] = { 8, 12, 16, 20, 31, 32 };
+static int Mod_Thrs[]   = { 28, 101 };
+static int Threads[]    = { 1, 3 };
+static int One_Pass[]   = { 0, 1 };
+
+#define NSIZES   ((int) (sizeof(Kmer_Sizes)/sizeof(int)))
+#define NMODS    ((int) (sizeof(Mod_Thrs)/sizeof(int)))
+#define NTHREADS ((int) (sizeof(Threads)/sizeof(int)))
+#define NPASSES  ((int) (sizeof(One_Pass)/sizeof(int)))
+
+  //  Make a block of nreads random reads laid out as Load_All_Reads would
+
+static void Random_Block(DAZZ_DB *db, int nreads)
+{ DAZZ_READ *reads;
+  char      *bases;
+  int64      totlen, o;
+  int        i, j, len;
+
+  reads = (DAZZ_READ *) Malloc(sizeof(DAZZ_READ)*(nreads+2),"Allocating reads") + 1;
+  if (reads == NULL)
+    exit (1);
+  bzero(reads-1,sizeof(DAZZ_READ)*(nreads+2));
+
+  totlen = 0;
+  db->maxlen = 0;
+  for (i = 0; i < nreads; i++)
+    { if (drand48() < .1)
+        len = 1 + lrand48() % 40;               //  Some reads shorter than a k-mer
+      else
+        len = 1 + lrand48() % MAXREAD;
+      reads[i].rlen = len;
+      totlen += len;
+      if (len > db->maxlen)
+        db->maxlen = len;
+    }
+
+  bases = (char *) Malloc(totlen+nreads+1,"Allocating bases");
+  if (bases == NULL)
+    exit (1);
+  *bases++ = 4;
+  o = 0;
+  for (i = 0; i < nreads; i++)
+    { reads[i].boff = o;
+      len = reads[i].rlen;
+      for (j = 0; j < len; j++)
+        bases[o+j] = lrand48() & 0x3;
+      bases[o+len] = 4;
+      o += len+1;
+    }
+  reads[nreads].boff = o;
+
+  db->nreads = nreads;
+  db->totlen = totlen;
+  db->reads  = reads;
+  db->bases  = (void *) bases;
+  db->tracks = NULL;
+}
+
+static void Free_Block(DAZZ_DB *db)
+{ free(db->reads-1);
+  free(((char *) db->bases)-1);
+}
+
+  //  Return 1 if files a and b have identical contents
+
+static int Same_File(char *a, char *b)
+{ FILE *fa, *fb;
+  int   ca, cb;
+
+  fa = fopen(a,"r");
+  fb = fopen(b,"r");
+  if (fa == NULL || fb == NULL)
+    { fprintf(stderr,"%s: Cannot open index files %s and %s\n",Prog_Name,a,b);
+      exit (1);
+    }
+  do
+    { ca = getc(fa);
+      cb = getc(fb);
+    }
+  while (ca == cb && ca != EOF);
+  fclose(fa);
+  fclose(fb);
+  return (ca == cb);
+}
+
+int main(int argc, char *argv[])
+{ DAZZ_DB _block, *block = &_block;
+  char    aname[100], sname[100];
+  void   *index;
+  int64   alen, slen;
+  int     b, k, m, t, o;
+  int     tests, fails;
+
+  Prog_Name = Strdup("tuple_test","");
+
+  VERBOSE   = 0;
+  SORT_PATH = "/tmp";
+  MEM_PHYSICAL = MEM_LIMIT = 0x1000000000ll;
+
+#if defined(__GNUC__) && defined(__x86_64__)
+  if ( ! __builtin_cpu_supports("avx2"))
+    { printf("%s: CPU does not have AVX2, nothing to compare\n",Prog_Name);
+      exit (0);
+    }
+#endif
+
+  sprintf(aname,"%s/%s.%d.avx2",SORT_PATH,Prog_Name,getpid());
+  sprintf(sname,"%s/%s.%d.scalar",SORT_PATH,Prog_Name,getpid());
+
+  if (argc > 1)
+    srand48(atol(argv[1]));
+  else
+    srand48(1);
+
+  tests = fails = 0;
+  for (b = 0; b < NBLOCKS; b++)
+    { Random_Block(block,1 + lrand48() % 300);
+      for (k = 0; k < NSIZES; k++)
+       for (m = 0; m < NMODS; m++)
+        for (t = 0; t < NTHREADS; t++)
+         for (o = 0; o < NPASSES; o++)
+          { Set_Filter_Params(Kmer_Sizes[k],Mod_Thrs[m],0,6,0,0,0,Threads[t]);
+            ONE_PASS = One_Pass[o];
+            Set_LSD_Params(Threads[t],0);
+
+            Set_Filter_AVX2(1);
+            index = Sort_Kmers(block,&alen,Threads[t],0);
+            Save_Kmers(aname,index,0,0);
+            Free_Kmers(index);
+
+            Set_Filter_AVX2(0);
+            index = Sort_Kmers(block,&slen,Threads[t],0);
+            Save_Kmers(sname,index,0,0);
+            Free_Kmers(index);
+
+            tests += 1;
+            if (alen != slen || (alen > 0 && ! Same_File(aname,sname)))
+              { printf("%s: block %d (%d reads) -k%d -%%%d -T%d%s: AVX2 index (%lld k-mers)",
+                       Prog_Name,b,block->nreads,Kmer_Sizes[k],Mod_Thrs[m],Threads[t],
+                       ONE_PASS ? " -O" : "",alen);
+                printf(" differs from scalar index (%lld k-mers)\n",slen);
+                fails += 1;
+              }
+          }
+      Free_Block(block);
+    }
+
+  unlink(aname);
+  unlink(sname);
+
+  if (fails > 0)
+    { printf("%s: %d of %d comparisons failed\n",Prog_Name,fails,tests);
+      exit (1);
+    }
+  printf("%s: AVX2 and scalar indices identical in %d comparisons\n",Prog_Name,tests);
+  exit (0);
+}